@@ -2,6 +2,7 @@
 #define GEOMETRY_H
 
 #include "unit.h"
+#include "vtkOutput.h"
 #include <map>
 /// STL triangle structure
 #ifdef _WIN32
@@ -33,7 +34,7 @@ public:
   Geometry(const lbRegion& r, const lbRegion& tr, const UnitEnv& units_);
   ~Geometry();
   int load(pugi::xml_node&);
-  void writeVTI(const char * filename);
+  void writeVTI(const char * filename, int encoding = VTK_BASE64);
   std::map<std::string,int> SettingZones;
 private:
   flag_t fg; ///< Foreground flag used for filling
@@ -26,6 +26,10 @@ int acAndersen::Init () {
                 int times;
                 double eps = 0;
 		GenericAction::Init();
+#if AA_PATTERN
+		error("Andersen acceleration mixes states of different steps, which is not possible with the in-place (AA) streaming\n");
+		return -1;
+#endif
 		pugi::xml_attribute attr = node.attribute("Directions");
 		if (attr) {
 			directions = attr.as_int();
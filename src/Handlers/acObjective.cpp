@@ -9,6 +9,7 @@ int acObjective::Init () {
 	double* grad = new double[n];
 	double* inObj = new double[n];
 	double obj = 0;
+	solver->lattice->syncGlobals();
 	for (size_t i = 0; i < n; i++) {
 		glob[i] = solver->lattice->globals[i];
 		inObj[i] = 0;
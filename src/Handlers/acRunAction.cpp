@@ -29,12 +29,12 @@ int acRunAction::Init () {
 				int it  = solver->hands[i].Next(solver->iter);
 				if ((it > 0) && (it < next_it)) next_it = it;
 			}
+			// The schedule (Next) depends only on the configuration and
+			// the iteration, so all the processes compute the same steps
 			solver->steps = next_it;
-			MPI_Bcast(&solver->steps, 1, MPI_INT, 0, MPMD.local);
 			solver->iter += solver->steps;
 			solver->lattice->IterateAction(action, solver->steps, solver->iter_type);
 			CudaDeviceSynchronize();
-			MPI_Barrier(MPMD.local);
 			for (size_t i=0; i<solver->hands.size(); i++) {
 				if (solver->hands[i].Now(solver->iter)) {
 					int ret = solver->hands[i].DoIt();
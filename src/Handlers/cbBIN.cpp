@@ -7,13 +7,17 @@ int cbBIN::Init () {
 		pugi::xml_attribute attr = node.attribute("name");
 		nm = "BIN";
 		if (attr) nm = attr.value();
+		attr = node.attribute("abs_error");
+		if (attr) if (bounds.add_from_string(attr.value(), false)) return -1;
+		attr = node.attribute("rel_error");
+		if (attr) if (bounds.add_from_string(attr.value(), true)) return -1;
 		return 0;
 	}
 
 
 int cbBIN::DoIt () {
 		Callback::DoIt();
-		return solver->writeBIN(nm.c_str());
+		return solver->writeBIN(nm.c_str(), &bounds);
 	};
 
 
@@ -5,9 +5,11 @@
 
 #include "vHandler.h"
 #include "Callback.h"
+#include "../LossyCodec.h"
 
 class  cbBIN  : public  Callback  {
 	std::string nm;
+	ErrorBounds bounds;
 	public:
 	static std::string xmlname;
 int Init ();
@@ -64,10 +64,11 @@ int cbFailcheck::DoIt () {
             if (components.in(it.name)) {
 			int comp = 1;
 			if (it.isVector) comp = 3;
-                    real_t* tmp = new real_t[reg.size()*comp];
+                    size_t n = reg.size()*comp;
+                    real_t* tmp = new real_t[n];
 		    solver->lattice->GetQuantity(it.id, reg, tmp, 1);
-                    bool cond = false;
-                    for (int k = 0; k < reg.size()*comp; k++){  
+                    int cond = false;
+                    for (size_t k = 0; k < n; k++){  
 	       		    cond = cond || (std::isnan(tmp[k]));
                     }
 		    delete[] tmp;
@@ -5,6 +5,7 @@ std::string cbHDF5::xmlname = "HDF5";
 
 int cbHDF5::Init () {
 		options = 0;
+		series = NULL;
 		Callback::Init();
 #ifdef WITH_HDF5
 		pugi::xml_attribute attr = node.attribute("name");
@@ -29,6 +30,17 @@ int cbHDF5::Init () {
 		attr = node.attribute("point_data");
 		if (attr) point_data = attr.as_bool();
 		if (point_data) options = options | HDF5_WRITE_POINT;
+		bool time_series = false;
+		attr = node.attribute("time_series");
+		if (attr) time_series = attr.as_bool();
+		if (time_series) options = options | HDF5_TIME_SERIES;
+		attr = node.attribute("abs_error");
+		if (attr) if (bounds.add_from_string(attr.value(), false)) return -1;
+		attr = node.attribute("rel_error");
+		if (attr) if (bounds.add_from_string(attr.value(), true)) return -1;
+		if (!bounds.empty() && !deflate) {
+			NOTICE("HDF5 error bounds only reduce the size of the file together with compress\n");
+		}
 		attr = node.attribute("chunk");
 		bool calc_double;
 #ifdef CALC_DOUBLE_PRECISION
@@ -125,6 +137,10 @@ int cbHDF5::Init () {
 			}
 			output("Negotiated HDF5 chunks: %ldx%ldx%ld[x3]\n", chunkdim[0], chunkdim[1], chunkdim[2]);
 		}                
+		if (options & HDF5_TIME_SERIES) {
+			series = hdf5OpenTimeSeries(nm.c_str(), solver, chunkdim, options, reg, &bounds);
+			if (series == NULL) return -1;
+		}
 		return 0;
 #else
 		ERROR("No hdf5 support at configure\n");
@@ -136,12 +152,19 @@ int cbHDF5::Init () {
 int cbHDF5::DoIt () {
 #ifdef WITH_HDF5
 		Callback::DoIt();
-		return hdf5WriteLattice(nm.c_str(), solver, &s, chunkdim, options, reg);
+		if (series != NULL) return hdf5WriteTimeSeries(series, solver, &s);
+		return hdf5WriteLattice(nm.c_str(), solver, &s, chunkdim, options, reg, &bounds);
 #else
 		return -1;
 #endif
 };
 
+int cbHDF5::Finish () {
+		hdf5CloseTimeSeries(series);
+		series = NULL;
+		return Callback::Finish();
+};
+
 
 // Register the handler (basing on xmlname) in the Handler Factory
 template class HandlerFactory::Register< GenericAsk< cbHDF5 > >;
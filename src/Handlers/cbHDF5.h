@@ -5,6 +5,9 @@
 
 #include "vHandler.h"
 #include "Callback.h"
+#include "../LossyCodec.h"
+
+struct hdf5TimeSeries;
 
 class  cbHDF5  : public  Callback  {
 	lbRegion reg;
@@ -12,10 +15,13 @@ class  cbHDF5  : public  Callback  {
 	name_set s;
 	unsigned long int chunkdim[3];
 	unsigned int options;
+	hdf5TimeSeries * series;
+	ErrorBounds bounds;
 public:
 	static std::string xmlname;
 	int Init ();
 	int DoIt ();
+	int Finish ();
 };
 
 #endif // CBHDF5_H
@@ -0,0 +1,41 @@
+#include "cbHaloError.h"
+std::string cbHaloError::xmlname = "HaloError";
+#include "../HandlerFactory.h"
+
+int cbHaloError::Init () {
+		Callback::Init();
+		solver->lattice->HaloReset();
+		solver->lattice->halo_check = true;
+		return 0;
+	}
+
+
+int cbHaloError::DoIt () {
+		Callback::DoIt();
+		Lattice * lattice = solver->lattice;
+		double err[FIELDS], mx[FIELDS];
+		MPI_Reduce(lattice->halo_err, err, FIELDS, MPI_DOUBLE, MPI_MAX, 0, MPMD.local);
+		MPI_Reduce(lattice->halo_max, mx, FIELDS, MPI_DOUBLE, MPI_MAX, 0, MPMD.local);
+		lattice->HaloReset();
+		if (solver->mpi_rank != 0) return 0;
+		if (solver->mpi.halo_precision == HALO_FULL) {
+			output("Halo sent in full precision\n");
+			return 0;
+		}
+		for (const Model::Field& it : lattice->model->fields) {
+			double rel = 0;
+			if (mx[it.id] > 0) rel = err[it.id] / mx[it.id];
+			output("Halo error of %s: %lg (relative %lg)\n", it.name.c_str(), err[it.id], rel);
+		}
+		return 0;
+	}
+
+
+int cbHaloError::Finish () {
+		solver->lattice->halo_check = false;
+		return Callback::Finish();
+	}
+
+
+// Register the handler (basing on xmlname) in the Handler Factory
+template class HandlerFactory::Register< GenericAsk< cbHaloError > >;
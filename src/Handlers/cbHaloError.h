@@ -0,0 +1,17 @@
+#ifndef CBHALOERROR_H
+#define CBHALOERROR_H
+
+#include "../CommonHandler.h"
+
+#include "vHandler.h"
+#include "Callback.h"
+
+class  cbHaloError  : public  Callback  {
+	public:
+	static std::string xmlname;
+int Init ();
+int DoIt ();
+int Finish ();
+};
+
+#endif // CBHALOERROR_H
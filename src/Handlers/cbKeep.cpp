@@ -45,6 +45,7 @@ int cbKeep::Init () {
 int cbKeep::DoIt () {
 		Callback::DoIt();
                 double s = 0.0;
+		solver->lattice->syncGlobals();
                 if (solver->mpi_rank == 0) {
                         double v = solver->lattice->globals[ what ];
                         output("Keep: %le compared to %le\n", v, thr);
@@ -97,7 +97,7 @@ int cbPID::DoIt () {
 		int ret=0;
 		pugi::xml_attribute attr;
 		double control, derivative;
-		
+		solver->lattice->syncGlobals();
                 if (solver->mpi_rank == 0) {
                         double val = solver->lattice->globals[ what ];
                         double err = target - val;
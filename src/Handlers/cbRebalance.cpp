@@ -0,0 +1,74 @@
+#include "cbRebalance.h"
+std::string cbRebalance::xmlname = "Rebalance";
+#include "../HandlerFactory.h"
+
+int cbRebalance::Init () {
+		char fn[2*STRING_LEN];
+		Callback::Init();
+		threshold = 0.1;
+		pugi::xml_attribute attr = node.attribute("threshold");
+		if (attr) threshold = attr.as_double();
+		repartition = true;
+		attr = node.attribute("repartition");
+		if (attr) repartition = attr.as_bool();
+		std::string nm = "Load";
+		attr = node.attribute("file");
+		if (attr) nm = attr.value();
+		solver->outGlobalFile(nm.c_str(), ".txt", fn);
+		filename = fn;
+		solver->lattice->LoadReset();
+		return 0;
+	}
+
+
+int cbRebalance::DoIt () {
+		Callback::DoIt();
+		Lattice * lattice = solver->lattice;
+		lattice->LoadCollect();
+		double t = 0;
+		if (lattice->load_iter > 0) t = lattice->load_time / lattice->load_iter;
+		lattice->LoadReset();
+		std::vector<double> times(solver->mpi_size);
+		MPI_Gather(&t, 1, MPI_DOUBLE, &times[0], 1, MPI_DOUBLE, 0, MPMD.local);
+		int go = 0;
+		if (solver->mpi_rank == 0) {
+			double mx = 0, sum = 0;
+			int imx = 0;
+			for (int i=0; i<solver->mpi_size; i++) {
+				sum += times[i];
+				if (times[i] > mx) { mx = times[i]; imx = i; }
+			}
+			if (sum > 0) {
+				double avg = sum / solver->mpi_size;
+				double imbalance = mx / avg - 1;
+				output("Load imbalance: %2.f%% (max %lg s on processor %d, average %lg s per iteration)\n", imbalance * 100, mx, imx, avg);
+				if (imbalance > threshold) go = 1;
+			}
+		}
+		MPI_Bcast(&go, 1, MPI_INT, 0, MPMD.local);
+		if (!go) return 0;
+		if (repartition) {
+			NOTICE("Load imbalance above %2.f%%. Repartitioning the lattice\n", threshold * 100);
+			if (solver->MPIRebalance(times) == 0) return 0;
+		}
+		if (solver->mpi_rank != 0) return 0;
+		FILE * f = fopen(filename.c_str(), "w");
+		if (f == NULL) {
+			ERROR("Cannot open %s for output\n", filename.c_str());
+			return -1;
+		}
+		const lbRegion& total = solver->info.region;
+		fprintf(f, "%d %d %d %d\n", total.nx, total.ny, total.nz, solver->mpi_size);
+		for (int i=0; i<solver->mpi_size; i++) {
+			const lbRegion& reg = solver->mpi.node[i].region;
+			fprintf(f, "%d %d %d %d %d %d %.9lg\n", reg.dx - total.dx, reg.dy - total.dy, reg.dz - total.dz, reg.nx, reg.ny, reg.nz, times[i]);
+		}
+		fclose(f);
+		NOTICE("Load imbalance above %2.f%%. Measured load saved to %s\n", threshold * 100, filename.c_str());
+		NOTICE("Restart with decomposition_load=\"%s\" to rebalance the mesh\n", filename.c_str());
+		return 0;
+	}
+
+
+// Register the handler (basing on xmlname) in the Handler Factory
+template class HandlerFactory::Register< GenericAsk< cbRebalance > >;
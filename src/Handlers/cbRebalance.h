@@ -0,0 +1,26 @@
+#ifndef CBREBALANCE_H
+#define CBREBALANCE_H
+
+#include "../CommonHandler.h"
+
+#include "vHandler.h"
+#include "Callback.h"
+
+/// Measurement of the load imbalance between the MPI processes
+/**
+  Above the threshold moves the cuts between the processors to balance
+  the measured load (Solver::MPIRebalance). If the lattice cannot be
+  repartitioned (or repartition="false"), saves the measured load
+  for the decomposition of the next run (decomposition_load).
+*/
+class  cbRebalance  : public  Callback  {
+	std::string filename;
+	double threshold;
+	bool repartition;
+	public:
+	static std::string xmlname;
+int Init ();
+int DoIt ();
+};
+
+#endif // CBREBALANCE_H
@@ -286,6 +286,7 @@ public:
 
 		double v = 1;
 		if (si) v = solver->units.alt(it.unit);
+		solver->lattice->syncGlobals();
 		ret[0] = v * solver->lattice->globals[it.id];
 		return ret;
 	}
@@ -52,6 +52,7 @@ int cbStop::Init () {
 int cbStop::DoIt () {
 		Callback::DoIt();
 		int ret=0;
+		solver->lattice->syncGlobals();
                 if (solver->mpi_rank == 0) {
                         int any = 0;
                         output("Stop criterium:");
@@ -13,6 +13,21 @@ int cbVTK::Init () {
 		} else {
 			s.add_from_string("all",',');
 		}
+		encoding = VTK_BASE64;
+		attr = node.attribute("format");
+		if (attr) {
+			encoding = vtkEncoding(attr.value());
+			if (encoding < 0) {
+				ERROR("Wrong format in VTK: %s (should be base64, appended or zlib)\n", attr.value());
+				return -1;
+			}
+		}
+		shared = false;
+		attr = node.attribute("shared");
+		if (attr) shared = attr.as_bool();
+		aggregators = 0;
+		attr = node.attribute("aggregators");
+		if (attr) aggregators = attr.as_int();
 
 		reg = solver->mpi.totalregion;
 	
@@ -60,7 +75,7 @@ int cbVTK::Init () {
 
 int cbVTK::DoIt () {
 		Callback::DoIt();
-		return solver->writeVTK(nm.c_str(), &s, reg);
+		return solver->writeVTK(nm.c_str(), &s, reg, encoding, shared, aggregators);
 	};
 
 
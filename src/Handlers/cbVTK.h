@@ -10,6 +10,9 @@ class  cbVTK  : public  Callback  {
 	lbRegion reg;
 	std::string nm;
 	name_set s;
+	int encoding;
+	bool shared;
+	int aggregators;
 	public:
 	static std::string xmlname;
 int Init ();
@@ -0,0 +1,204 @@
+#include "LossyCodec.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <mpi.h>
+#include "Global.h"
+
+/// Add bounds from a string
+/**
+	\param str Bound for all quantities ("1e-4") or list of bounds ("U:1e-4,Rho:1e-6")
+	\param relative Treat the bounds as relative to the range of the field
+	\return -1 on a malformed bound
+*/
+int ErrorBounds::add_from_string(const std::string& str, bool relative)
+{
+	size_t start = 0;
+	while (start < str.size()) {
+		size_t end = str.find(',', start);
+		if (end == std::string::npos) end = str.size();
+		std::string item = str.substr(start, end - start);
+		start = end + 1;
+		if (item.empty()) continue;
+		std::string name;
+		size_t colon = item.find(':');
+		if (colon != std::string::npos) {
+			name = item.substr(0, colon);
+			item = item.substr(colon + 1);
+		}
+		char * rest;
+		double val = strtod(item.c_str(), &rest);
+		if (rest == item.c_str() || *rest != '\0' || !(val >= 0)) {
+			ERROR("Wrong error bound: \"%s\"\n", item.c_str());
+			return -1;
+		}
+		if (relative) bounds[name].rel = val; else bounds[name].abs = val;
+	}
+	return 0;
+}
+
+/// Get the bounds of a quantity
+/**
+	\return false if the quantity is to be written losslessly
+*/
+bool ErrorBounds::get(const std::string& name, double& abs, double& rel) const
+{
+	std::map< std::string, Bound >::const_iterator it = bounds.find(name);
+	if (it == bounds.end()) it = bounds.find("");
+	if (it == bounds.end()) return false;
+	abs = it->second.abs;
+	rel = it->second.rel;
+	return abs > 0 || rel > 0;
+}
+
+/// Quantization step of a quantity
+/**
+	The values rounded to a multiple of the step are off by at most
+	half of it, so the step is twice the tighter of the bounds (less the
+	rounding of the values to the stored type).
+	\param min Minimum of the field
+	\param max Maximum of the field
+	\param eps Machine epsilon of the type the values are stored in
+	\return Quantization step (0 - lossless)
+*/
+double ErrorBounds::Step(const std::string& name, double min, double max, double eps) const
+{
+	double abs, rel;
+	if (!get(name, abs, rel)) return 0;
+	double bound = abs;
+	if (rel > 0) {
+		double range = max - min;
+		if (!(range > 0)) range = fabs(max);
+		if (range > 0) {
+			if (bound <= 0 || rel * range < bound) bound = rel * range;
+		}
+	}
+	bound -= eps * fmax(fabs(min), fabs(max));
+	if (!(bound > 0) || !isfinite(bound)) return 0;
+	return 2 * bound;
+}
+
+/// Quantization step of a field distributed over the processes
+/**
+	Collective: the range of the field (needed for the relative bounds)
+	is reduced over the communicator.
+	\param data Local part of the field
+	\param n Number of local values
+	\param min Set to the minimum of the field
+	\param eps Machine epsilon of the type the values are stored in
+	\return Quantization step (0 - lossless)
+*/
+double LossyStep(const ErrorBounds& bounds, const std::string& name, const real_t * data, size_t n, MPI_Comm comm, double& min, double eps)
+{
+	double range[2], total[2];
+	range[0] = -INFINITY;
+	range[1] = -INFINITY;
+	for (size_t i=0; i<n; i++) {
+		double v = data[i];
+		if (!isfinite(v)) continue;
+		if (-v > range[0]) range[0] = -v;
+		if (v > range[1]) range[1] = v;
+	}
+	MPI_Allreduce(range, total, 2, MPI_DOUBLE, MPI_MAX, comm);
+	min = -total[0];
+	return bounds.Step(name, min, total[1], eps);
+}
+
+/// Round the values to a power of two not larger than the step
+/**
+	Zeroes the low mantissa bits of the values, leaving the data readable
+	as plain floating point, but compressing much better with deflate.
+*/
+void LossyRound(real_t * data, size_t n, double step)
+{
+	if (!(step > 0)) return;
+	double pow2 = ldexp(1.0, ilogb(step));
+	for (size_t i=0; i<n; i++) {
+		double v = data[i];
+		if (isfinite(v)) data[i] = nearbyint(v / pow2) * pow2;
+	}
+}
+
+/// Append a value to a buffer
+template <typename T> inline void LossyPut(std::vector<char>& out, T val)
+{
+	size_t pos = out.size();
+	out.resize(pos + sizeof(T));
+	memcpy(&out[pos], &val, sizeof(T));
+}
+
+/// Encode a field with a bounded absolute error
+/**
+	The values are quantized to offset + q*step, the consecutive q of each
+	component are delta coded, and the (zig-zag) deltas are bit-packed in
+	blocks of LOSSY_BLOCK values with a common bit width. A field with
+	non-finite values (or a range too large for the step) is stored raw.
+	Layout (native little-endian): magic[8], uint32 sizeof(real_t), uint32 comp,
+	uint64 n, double offset, double step (0 - raw data), data.
+	\param n Number of values (including components)
+	\param comp Number of the interleaved components
+	\param step Quantization step (0 - lossless)
+	\param offset Value of q = 0 (usually the minimum of the field)
+*/
+void LossyEncode(const real_t * data, size_t n, int comp, double step, double offset, std::vector<char>& out)
+{
+	double max = offset;
+	if (step > 0) {
+		for (size_t i=0; i<n; i++) {
+			double v = data[i];
+			if (!isfinite(v)) { step = 0; break; }
+			if (v > max) max = v;
+			if (v < offset) { step = 0; break; }
+		}
+	}
+	if (step > 0 && (max - offset) / step > 4.0e15) step = 0;
+	if (!(step > 0)) step = 0;
+
+	out.clear();
+	out.insert(out.end(), LOSSY_MAGIC, LOSSY_MAGIC + 8);
+	LossyPut<uint32_t>(out, sizeof(real_t));
+	LossyPut<uint32_t>(out, comp);
+	LossyPut<uint64_t>(out, n);
+	LossyPut<double>(out, offset);
+	LossyPut<double>(out, step);
+	if (step == 0) {
+		const char * raw = (const char *) data;
+		out.insert(out.end(), raw, raw + n*sizeof(real_t));
+		return;
+	}
+
+	std::vector<int64_t> last(comp, 0);
+	uint64_t block[LOSSY_BLOCK];
+	for (size_t i=0; i<n; i+=LOSSY_BLOCK) {
+		size_t m = n - i;
+		if (m > LOSSY_BLOCK) m = LOSSY_BLOCK;
+		uint64_t all = 0;
+		for (size_t j=0; j<m; j++) {
+			int c = (i + j) % comp;
+			int64_t q = llrint(((double) data[i+j] - offset) / step);
+			int64_t d = q - last[c];
+			last[c] = q;
+			block[j] = ((uint64_t) d << 1) ^ (uint64_t) (d >> 63);
+			all |= block[j];
+		}
+		int width = 0;
+		while (width < 64 && (all >> width) != 0) width++;
+		out.push_back((char) width);
+		size_t pos = out.size();
+		out.resize(pos + (m*width + 7)/8, 0);
+		unsigned char * bits = (unsigned char *) &out[pos];
+		uint64_t acc = 0;
+		int nbits = 0;
+		for (size_t j=0; j<m; j++) { // width <= 54 (range check above), so the value fits beside the < 8 pending bits
+			acc |= block[j] << nbits;
+			nbits += width;
+			while (nbits >= 8) {
+				*(bits++) = acc & 0xFF;
+				acc >>= 8;
+				nbits -= 8;
+			}
+		}
+		if (nbits > 0) *bits = acc & 0xFF;
+	}
+}
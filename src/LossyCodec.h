@@ -0,0 +1,38 @@
+#ifndef LOSSYCODEC_H
+#define LOSSYCODEC_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <limits>
+#include <mpi.h>
+#include "types.h"
+
+#define LOSSY_MAGIC "TCLBLSY1"
+#define LOSSY_BLOCK 64
+
+/// Error bounds of the lossy output (per quantity)
+/**
+	Bounds are given as "1e-4" (all quantities) or "U:1e-4,Rho:1e-6"
+	(per quantity). An absolute bound is in the units of the written data,
+	a relative bound is a fraction of the range of the field. If both are
+	given for a quantity, the tighter one is used.
+*/
+class ErrorBounds {
+	struct Bound {
+		double abs, rel;
+		Bound() : abs(0), rel(0) {}
+	};
+	std::map< std::string, Bound > bounds; ///< Bounds by quantity ("" - all quantities)
+public:
+	int add_from_string(const std::string& str, bool relative);
+	inline bool empty() const { return bounds.empty(); }
+	bool get(const std::string& name, double& abs, double& rel) const;
+	double Step(const std::string& name, double min, double max, double eps = std::numeric_limits<real_t>::epsilon()) const;
+};
+
+double LossyStep(const ErrorBounds& bounds, const std::string& name, const real_t * data, size_t n, MPI_Comm comm, double& min, double eps = std::numeric_limits<real_t>::epsilon());
+void LossyRound(real_t * data, size_t n, double step);
+void LossyEncode(const real_t * data, size_t n, int comp, double step, double offset, std::vector<char>& out);
+
+#endif
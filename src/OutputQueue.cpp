@@ -0,0 +1,122 @@
+#include "OutputQueue.h"
+#include <utility>
+#include "Global.h"
+
+OutputQueue::OutputQueue() : max_inflight(0), inflight(0), failed(0), stop(false) {}
+
+OutputQueue::~OutputQueue()
+{
+	Wait();
+	if (thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = true;
+		}
+		changed.notify_all();
+		thread.join();
+	}
+	for (size_t i=0; i<pool.size(); i++) delete pool[i];
+}
+
+/// Set the number of writes in flight
+/**
+ Starts the writer thread if needed
+ \param max_inflight_ Max number of writes queued or being written (0 - synchronous)
+*/
+void OutputQueue::Start(int max_inflight_)
+{
+	Wait();
+	max_inflight = max_inflight_;
+	if (max_inflight < 0) max_inflight = 0;
+	if (max_inflight > 0 && !thread.joinable()) thread = std::thread(&OutputQueue::Run, this);
+}
+
+/// Loop of the writer thread
+void OutputQueue::Run()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		while (jobs.empty() && !stop) changed.wait(guard);
+		if (jobs.empty()) break;
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		guard.unlock();
+		int ret = job();
+		job = Job(); // Releasing the buffers before the job is counted as done
+		guard.lock();
+		if (ret) failed++;
+		inflight--;
+		changed.notify_all();
+	}
+}
+
+/// Return a buffer to the pool
+void OutputQueue::Release(std::vector<char> * buf)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	pool.push_back(buf);
+}
+
+/// Get a host buffer from the pool
+/**
+ The buffer goes back to the pool when the last copy of the pointer is released
+ (usually when the job using it is done)
+ \param size Size of the buffer in bytes
+*/
+OutputBuffer OutputQueue::Buffer(size_t size)
+{
+	std::vector<char> * buf = NULL;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		size_t best = pool.size();
+		for (size_t i=0; i<pool.size(); i++) {
+			if (pool[i]->capacity() >= size) {
+				if (best == pool.size() || pool[i]->capacity() < pool[best]->capacity()) best = i;
+			}
+		}
+		if (best == pool.size() && pool.size() > 0) best = 0; // Reallocating a smaller one
+		if (best < pool.size()) {
+			buf = pool[best];
+			pool[best] = pool.back();
+			pool.pop_back();
+		}
+	}
+	if (buf == NULL) buf = new std::vector<char>;
+	buf->resize(size);
+	return OutputBuffer(buf, [this](std::vector<char> * b) { Release(b); });
+}
+
+/// Write a file in the background
+/**
+ Waits if the max number of writes is in flight already
+ \param job Encoding and writing of the file (without MPI)
+ \return -1 if this (synchronous) or any previous (asynchronous) write failed
+*/
+int OutputQueue::Push(const Job& job)
+{
+	if (!Async()) return job() ? -1 : 0;
+	std::unique_lock<std::mutex> guard(lock);
+	if (inflight >= max_inflight) {
+		debug1("Output: waiting for %d writes in flight\n", inflight);
+		while (inflight >= max_inflight) changed.wait(guard);
+	}
+	jobs.push_back(job);
+	inflight++;
+	changed.notify_all();
+	int ret = failed ? -1 : 0;
+	failed = 0;
+	return ret;
+}
+
+/// Wait for all the writes in flight
+/**
+ \return -1 if any of the writes failed
+*/
+int OutputQueue::Wait()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (inflight > 0) changed.wait(guard);
+	int ret = failed ? -1 : 0;
+	failed = 0;
+	return ret;
+}
@@ -0,0 +1,49 @@
+#ifndef OUTPUTQUEUE_H
+#define OUTPUTQUEUE_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/// Host buffer for the data of an output file (returned to the pool when released)
+typedef std::shared_ptr< std::vector<char> > OutputBuffer;
+
+/// Background writer of the output files
+/**
+ The data of an output is gathered (GetQuantity) by the solver into
+ pooled host buffers, and the encoding and writing of the files is done
+ by a writer thread, while the solver keeps iterating. The writer does
+ not call MPI, so all the collective parts of a write have to be done
+ before the job is pushed. With no writes in flight allowed (the default)
+ the jobs are run right away.
+*/
+class OutputQueue {
+public:
+	typedef std::function<int()> Job; ///< Writing of a file (returns non-zero on error)
+private:
+	std::thread thread;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<Job> jobs; ///< Jobs waiting for the writer
+	std::vector< std::vector<char> * > pool; ///< Free buffers
+	int max_inflight; ///< Max number of jobs queued or being written (0 - synchronous)
+	int inflight; ///< Number of jobs queued or being written
+	int failed; ///< Number of jobs which failed since the last Wait
+	bool stop;
+	void Run();
+	void Release(std::vector<char> * buf);
+public:
+	OutputQueue();
+	~OutputQueue();
+	void Start(int max_inflight_);
+	inline bool Async() const { return max_inflight > 0; }
+	OutputBuffer Buffer(size_t size);
+	int Push(const Job& job);
+	int Wait();
+};
+
+#endif
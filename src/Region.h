@@ -9,8 +9,8 @@ public:
   inline lbRegion(int w, int h):dx(0),dy(0),dz(0),nx(w),ny(h),nz(1) {};
   inline lbRegion(int x, int y, int w, int h):dx(x),dy(y),dz(0),nx(w),ny(h),nz(1){};
   inline lbRegion(int x, int y, int z, int w, int h, int d):dx(x),dy(y),dz(z),nx(w),ny(h),nz(d){};
-  CudaHostFunction CudaDeviceFunction inline int size() { return nx*ny*nz; };
-  CudaHostFunction CudaDeviceFunction inline size_t sizeL() { return nx*ny*nz; };
+  CudaHostFunction CudaDeviceFunction inline size_t size() { return (size_t) nx*ny*nz; };
+  CudaHostFunction CudaDeviceFunction inline size_t sizeL() { return (size_t) nx*ny*nz; };
   inline int isIn(int x, int y) { return (x >= dx) && (y >= dy) && (x-dx < nx) && (y-dy < ny); }
   inline int isIn(int x, int y, int z) { return (x >= dx) && (y >= dy) && (z >= dz) && (x-dx < nx) && (y-dy < ny) && (z-dz < nz); }
   inline int isEqual(const lbRegion& other) { return (other.dx == dx) && (other.dy == dy) && (other.dz == dz) && (other.nx == nx) && (other.ny == ny) && (other.nz == nz); }
@@ -25,17 +25,17 @@ public:
     if (ret.nx <= 0 || ret.ny <= 0 || ret.nz <= 0) { ret.nx = ret.ny = ret.nz = 0; };
     return ret;
   };
-  inline int offset(int x,int y) {
-    return (x-dx) + (y-dy) * nx;
+  inline size_t offset(int x,int y) {
+    return (x-dx) + (size_t) (y-dy) * nx;
   };
   inline void print() {
     printf("Region: %dx%dx%d + %d,%d,%d\n", nx,ny,nz,dx,dy,dz);
   };
-  CudaHostFunction CudaDeviceFunction inline int offset(int x,int y,int z) {
-    return (x-dx) + (y-dy) * nx + (z-dz) * nx * ny;
+  CudaHostFunction CudaDeviceFunction inline size_t offset(int x,int y,int z) {
+    return (x-dx) + (size_t) (y-dy) * nx + (size_t) (z-dz) * nx * ny;
   };
   CudaHostFunction CudaDeviceFunction inline size_t offsetL(int x,int y,int z) {
-    return (x-dx) + (y-dy) * nx + (z-dz) * nx * ny;
+    return offset(x,y,z);
   };
 
 };
@@ -51,7 +51,7 @@ int Sampler::writeHistory(int curr_iter) {
 				real_t tmp;
 				int comp = 1;
 				if (it.isVector) comp = 3;
-				CudaMemcpy(&tmp,&gpu_buffer[(location[it.name] + (i - startIter)*size + totalIter*j*size)],sizeof(real_t)*comp,CudaMemcpyDeviceToHost); 
+				CudaMemcpy(&tmp,&gpu_buffer[(location[it.name] + (size_t) (i - startIter)*size + totalIter*j*size)],sizeof(real_t)*comp,CudaMemcpyDeviceToHost); 
 				csvWriteElement(f,tmp);
 			}
 		}
@@ -74,7 +74,7 @@ int Sampler::Allocate(name_set* nquantities,int start,int iter) {
 			if (it.isVector) i = i + 3; else i = i + 1;
 		}
 	}
-	CudaMalloc((void**)&gpu_buffer, i*totalIter*spoints.size()*sizeof(real_t)); 
+	CudaMalloc((void**)&gpu_buffer, (size_t) i*totalIter*spoints.size()*sizeof(real_t)); 
 	size = i;
 	return 0;
 }
@@ -30,7 +30,7 @@ class Sampler {
 		real_t *gpu_buffer;
                	Location location;
                	name_set *quant;
-               	int size;
+               	size_t size; ///< Number of values stored per point and iteration
 		UnitEnv units;
 		std::vector <sreg> spoints; 
 		MPIInfo mpis; 
@@ -6,10 +6,299 @@
 #include <vector>
 #include <algorithm>
 #include <iostream>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <unistd.h>
+#ifdef CROSS_CPU
+	#include <sys/mman.h>
+	#ifdef CROSS_OPENMP
+		#include <thread>
+		#include <condition_variable>
+		#include <pthread.h>
+		#include <sched.h>
+	#endif
+#endif
 
 #ifdef CROSS_CPU
 
-uint3 CpuBlock, CpuThread, CpuSize;
+#ifdef CROSS_OPENMP
+thread_local uint3 CpuBlock;
+#else
+uint3 CpuBlock;
+#endif
+uint3 CpuThread, CpuSize;
+CpuTiling CpuTile = {0, 0, false};
+std::function<bool()> CpuProgress;
+bool CpuProgressAllowed = true;
+CpuTeamMode CpuTeamConf = {false, false};
+
+#ifdef CROSS_OPENMP
+thread_local int CpuTeamRank = 0;
+thread_local int CpuRow = -1;
+
+/// State of the persistent thread team
+/**
+  Workers spin on the job counter for a while and then sleep on
+  the condition variable, so that an idle team (e.g. during output)
+  does not keep the cores busy.
+*/
+static struct {
+	std::vector< std::thread > workers;
+	int size = 0;
+	std::atomic< unsigned int > job { 0 };
+	std::atomic< int > done { 0 };
+	bool stop = false;
+	void (*fn)(void *, int, int) = NULL;
+	void * ctx = NULL;
+	std::mutex mutex;
+	std::condition_variable cond;
+} Team;
+
+#define TEAM_SPIN 20000
+
+/// Bind the calling thread to one CPU
+static void CpuPin(int cpu) {
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+}
+
+static void CpuTeamWorker(int rank, int cpu) {
+	if (cpu >= 0) CpuPin(cpu);
+	CpuTeamRank = rank;
+	unsigned int seen = 0;
+	while (true) {
+		int spin = 0;
+		while (Team.job.load(std::memory_order_acquire) == seen) {
+			if (++spin > TEAM_SPIN) {
+				std::unique_lock< std::mutex > lock(Team.mutex);
+				Team.cond.wait(lock, [seen]() { return Team.job.load(std::memory_order_acquire) != seen; });
+			}
+		}
+		seen = Team.job.load(std::memory_order_acquire);
+		if (Team.stop) return;
+		Team.fn(Team.ctx, rank, Team.size);
+		Team.done.fetch_add(1, std::memory_order_release);
+	}
+}
+
+/// Start the persistent team of n threads (including the calling one)
+/**
+  If pin is set, worker k is bound to the k-th CPU of the process affinity mask.
+  The calling (master) thread is left unbound, as it also runs MPI and OpenMP code.
+*/
+void CpuTeamStart(int n, bool pin) {
+	if (Team.size > 0) CpuTeamStop();
+	if (n < 2) return;
+	std::vector< int > cpus;
+	if (pin) {
+		cpu_set_t mask;
+		if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+			for (int i = 0; i < CPU_SETSIZE; i++) if (CPU_ISSET(i, &mask)) cpus.push_back(i);
+		}
+	}
+	Team.stop = false;
+	Team.size = n;
+	for (int rank = 1; rank < n; rank++) {
+		int cpu = cpus.empty() ? -1 : cpus[rank % cpus.size()];
+		Team.workers.push_back(std::thread(CpuTeamWorker, rank, cpu));
+	}
+	debug1("Started a team of %d CPU threads\n", n);
+}
+
+/// Stop the persistent team
+void CpuTeamStop() {
+	if (Team.size == 0) return;
+	{
+		std::lock_guard< std::mutex > lock(Team.mutex);
+		Team.stop = true;
+		Team.job.fetch_add(1, std::memory_order_release);
+	}
+	Team.cond.notify_all();
+	for (size_t i = 0; i < Team.workers.size(); i++) Team.workers[i].join();
+	Team.workers.clear();
+	Team.size = 0;
+}
+
+int CpuTeamSize() {
+	return Team.size;
+}
+
+/// Run fn(ctx, rank, size) on all the threads of the team and wait for it
+void CpuTeamRun(void (*fn)(void *, int, int), void * ctx) {
+	Team.fn = fn;
+	Team.ctx = ctx;
+	Team.done.store(0, std::memory_order_relaxed);
+	{
+		std::lock_guard< std::mutex > lock(Team.mutex);
+		Team.job.fetch_add(1, std::memory_order_release);
+	}
+	Team.cond.notify_all();
+	fn(ctx, 0, Team.size);
+	while (Team.done.load(std::memory_order_acquire) < Team.size - 1) {}
+}
+#endif
+
+/// Interleave bits of two indexes (Morton code)
+static inline unsigned long long int MortonCode(unsigned int x, unsigned int y) {
+	unsigned long long int ret = 0;
+	for (int i=0; i<32; i++) {
+		ret |= (unsigned long long int) ((x >> i) & 1) << (2*i);
+		ret |= (unsigned long long int) ((y >> i) & 1) << (2*i+1);
+	}
+	return ret;
+}
+
+/// Order in which CPUKernelRun walks a ntx x nty grid of tiles
+/**
+  The orders are cached, as the same few grids are used in every iteration.
+  The cache is shared by all the lattices (and host threads), so it is locked;
+  an order, once made, is never changed, so the returned pointer stays valid.
+*/
+const unsigned int * CpuTileOrder(unsigned int ntx, unsigned int nty) {
+	static std::mutex lock;
+	static std::map< std::tuple< unsigned int, unsigned int, bool >, std::vector< unsigned int > > cache;
+	std::lock_guard< std::mutex > guard(lock);
+	std::vector< unsigned int > & order = cache[std::make_tuple(ntx, nty, CpuTile.morton)];
+	if (order.size() != (size_t) ntx*nty) {
+		order.resize((size_t) ntx*nty);
+		for (size_t t=0; t<order.size(); t++) order[t] = t;
+		if (CpuTile.morton) std::sort(order.begin(), order.end(), [ntx](unsigned int a, unsigned int b) {
+			return MortonCode(a % ntx, a / ntx) < MortonCode(b % ntx, b / ntx);
+		});
+	}
+	return order.data();
+}
+
+/// Size of a level (2 or 3) of the CPU cache (0 - unknown)
+size_t CpuCacheSize(int level) {
+	long size = 0;
+	#ifdef _SC_LEVEL2_CACHE_SIZE
+		if (level == 2) size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	#endif
+	#ifdef _SC_LEVEL3_CACHE_SIZE
+		if (level == 3) size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	#endif
+	if (size < 0) size = 0;
+	return size;
+}
+
+/// Select a square tile size, so that a tile with its neighbours fits in L2
+/**
+  \param row_size Size (in bytes) of one x-row of the lattice
+*/
+unsigned int CpuTileAuto(size_t row_size) {
+	long l2 = CpuCacheSize(2);
+	if (l2 <= 0) l2 = 1024*1024;
+	unsigned int t = 1;
+	while ((size_t) (t+3)*(t+3)*row_size <= (size_t) l2) t++;
+	return t;
+}
+
+CpuMemoryMode CpuMemory = {true, CPU_HUGE_NO};
+
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+/// Regions allocated with explicit huge pages (mmap)
+static std::map< void *, size_t > CpuMapped;
+
+/// Allocate CPU memory (with huge pages if selected)
+/**
+  Huge pages are used only for allocations of at least one huge page.
+  If explicit huge pages are not available, it falls back to transparent ones.
+*/
+void * CpuMalloc(size_t size) {
+	if (size >= HUGE_PAGE_SIZE) {
+		size_t hsize = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		if (CpuMemory.huge_pages == CPU_HUGE_EXPLICIT) {
+		#ifdef MAP_HUGETLB
+			void * ptr = mmap(NULL, hsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (ptr != MAP_FAILED) {
+				CpuMapped[ptr] = hsize;
+				return ptr;
+			}
+		#endif
+			WARNING("Could not get %ld b of explicit huge pages. Using transparent huge pages\n", hsize);
+		}
+		if (CpuMemory.huge_pages != CPU_HUGE_NO) {
+			void * ptr = NULL;
+			if (posix_memalign(&ptr, HUGE_PAGE_SIZE, hsize) != 0) return NULL;
+		#ifdef MADV_HUGEPAGE
+			madvise(ptr, hsize, MADV_HUGEPAGE);
+		#endif
+			return ptr;
+		}
+	}
+	return malloc(size);
+}
+
+/// Free memory allocated with CpuMalloc
+void CpuFree(void * ptr) {
+	std::map< void *, size_t >::iterator it = CpuMapped.find(ptr);
+	if (it != CpuMapped.end()) {
+		munmap(it->first, it->second);
+		CpuMapped.erase(it);
+	} else {
+		free(ptr);
+	}
+}
+
+/// Zero the part of a buffer used by one of the threads
+/**
+  The thread gets the z-slabs [nz*rank/nth, nz*(rank+1)/nth) of every field
+  (or an equal range of pages of a buffer without z-slabs).
+*/
+static void CpuFirstTouchPart(char * tab, size_t size, size_t fields, size_t nz, int rank, int nth) {
+	if (nz > 1) {
+		const size_t slab = size / (fields * nz);
+		const size_t z0 = nz*rank/nth, z1 = nz*(rank+1)/nth;
+		for (size_t f = 0; f < fields; f++)
+			if (z1 > z0) memset(tab + (f*nz + z0)*slab, 0, (z1 - z0)*slab);
+		return;
+	}
+	const size_t page = 4096;
+	const size_t n = (size + page - 1) / page;
+	const size_t i0 = n*rank/nth, i1 = n*(rank+1)/nth;
+	if (i1 > i0) memset(tab + i0*page, 0, (i1 == n ? size : i1*page) - i0*page);
+}
+
+/// Zero a buffer, first-touching its pages by the threads which will use them
+/**
+  The buffers of the lattice are made of fields, each stored z-major
+  (with --cpu-layout the fields are interleaved, so the whole buffer is one
+  z-major field). CPUKernelRun hands out the rows of blocks in z-major order
+  with a static schedule, so up to the border rows (and the tiling) each
+  thread works on an equal range of z-slabs of every field. Zeroing these
+  slabs by the same thread places their pages on its NUMA node.
+  \param fields Number of the fields in the buffer
+  \param nz Number of the z-slabs of a field (1: buffer without z-slabs)
+*/
+void CpuFirstTouch(void * ptr, size_t size, size_t fields, size_t nz) {
+	if (!CpuMemory.first_touch) {
+		memset(ptr, 0, size);
+		return;
+	}
+	char * tab = (char *) ptr;
+	if (fields < 1 || nz < 1 || size % (fields * nz) != 0) {
+		fields = 1;
+		nz = 1;
+	}
+	#ifdef CROSS_OPENMP
+	if (CpuTeamSize() > 1) {
+		auto job = [&](int rank, int nth) {
+			CpuFirstTouchPart(tab, size, fields, nz, rank, nth);
+		};
+		CpuTeamRun(&CpuTeamCall< decltype(job) >, &job);
+		return;
+	}
+	#pragma omp parallel
+	CpuFirstTouchPart(tab, size, fields, nz, omp_get_thread_num(), omp_get_num_threads());
+	#else
+	memset(tab, 0, size);
+	#endif
+}
 
 void memcpy2D(void * dst_, int dpitch, void * src_, int spitch, int width, int height) {
 	char * dst = (char*) dst_, *src = (char*) src_;
@@ -38,9 +327,11 @@ CudaError HandleError( CudaError err,
         struct ptrpair {
                 void ** ptr;
                 size_t size;
-                ptrpair() { ptr=NULL; size = 0; }
-                ptrpair(const ptrpair & p) { ptr=p.ptr; size=p.size; };
-                ptrpair(void ** ptr_, size_t size_) { ptr=ptr_; size=size_; };
+                size_t used; ///< Requested size (before the alignment)
+                size_t fields, nz; ///< Fields and z-slabs of the buffer (for the first touch)
+                ptrpair() { ptr=NULL; size = 0; used = 0; fields = 1; nz = 1; }
+                ptrpair(const ptrpair & p) { ptr=p.ptr; size=p.size; used=p.used; fields=p.fields; nz=p.nz; };
+                ptrpair(void ** ptr_, size_t size_, size_t fields_, size_t nz_) { ptr=ptr_; size=size_; used=size_; fields=fields_; nz=nz_; };
                 inline const bool operator< (const ptrpair & B) const {
                         return size < B.size;
                 };
@@ -49,9 +340,9 @@ CudaError HandleError( CudaError err,
         std::vector< ptrpair > ptrlist;
         std::vector< std::pair< void *, std::vector< ptrpair > > > freelist;
 
-        CudaError cudaPreAlloc(void ** ptr, size_t size) {
+        CudaError cudaPreAlloc(void ** ptr, size_t size, size_t fields, size_t nz) {
                 debug1("Preallocation of %d b\n", (int) size);
-                ptrlist.push_back(ptrpair(ptr, size));
+                ptrlist.push_back(ptrpair(ptr, size, fields, nz));
         //	return cudaMalloc(ptr, size);
                 return CudaSuccess;
         }
@@ -85,7 +376,9 @@ CudaError HandleError( CudaError err,
                         ERROR("FATAL ERROR: Not enaught memory! tried to allocate (cumulatice): %ld\n", fullsize);
                         exit(-1);
                 }
+        #ifndef CROSS_CPU
                 CudaMemset( tmp, 0, fullsize );
+        #endif
                 void * main_ptr = tmp;
                 std::vector< ptrpair > tofree;
                 while (!ptrlist.empty()) {
@@ -93,6 +386,10 @@ CudaError HandleError( CudaError err,
                         debug1("[%d] Preallocation gave %d b\n", D_MPI_RANK, (int) ptr.size);
         //		cudaMalloc(ptr.ptr,ptr.size);
                         *(ptr.ptr) = (void **)tmp;
+        #ifdef CROSS_CPU
+                        CudaFirstTouchSlabs( tmp, ptr.used, ptr.fields, ptr.nz );
+                        memset(tmp + ptr.used, 0, ptr.size - ptr.used);
+        #endif
                         tmp += ptr.size;
                         tofree.push_back(ptr);
                         ptrlist.pop_back();
@@ -120,10 +417,10 @@ CudaError HandleError( CudaError err,
 
 #else
 
-        CudaError cudaPreAlloc(void ** ptr, size_t size) {
+        CudaError cudaPreAlloc(void ** ptr, size_t size, size_t fields, size_t nz) {
                 debug1("Preallocation of %d b\n", (int) size);
                 CudaMalloc(ptr, size); // This macro has error checking already
-                CudaMemset( *ptr, 0, size );
+                CudaFirstTouchSlabs( *ptr, size, fields, nz );
                 return CudaSuccess;
         }
 
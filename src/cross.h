@@ -81,6 +81,7 @@
 
     #define CudaMemcpyDeviceToHost cudaMemcpyDeviceToHost
     #define CudaMemcpyHostToDevice cudaMemcpyHostToDevice
+    #define CudaMemcpyDeviceToDevice cudaMemcpyDeviceToDevice
     #define CudaCopyToConstant(a__,b__,c__,d__) HANDLE_ERROR( cudaMemcpyToSymbol(b__, c__, d__, 0, cudaMemcpyHostToDevice))
     #define CudaMemcpy2D(a__,b__,c__,d__,e__,f__,g__) HANDLE_ERROR( cudaMemcpy2D(a__, b__, c__, d__, e__, f__, g__) )
     #define CudaMemcpy(a__,b__,c__,d__) HANDLE_ERROR( cudaMemcpy(a__, b__, c__, d__) )
@@ -92,8 +93,11 @@
       #define CudaMemcpyPeerAsync(a__,b__,c__,d__,e__,f__) HANDLE_ERROR( cudaMemcpyPeerAsync(a__, b__, c__, d__, e__, f__) )
     #endif
     #define CudaMemset(a__,b__,c__) HANDLE_ERROR( cudaMemset(a__, b__, c__) )
+    #define CudaFirstTouch(a__,b__) CudaMemset(a__, 0, b__)
+    #define CudaFirstTouchSlabs(a__,b__,c__,d__) CudaMemset(a__, 0, b__)
     #define CudaMalloc(a__,b__) HANDLE_ERROR( cudaMalloc(a__,b__) )
     #define CudaPreAlloc(a__,b__) HANDLE_ERROR( cudaPreAlloc(a__,b__) )
+    #define CudaPreAllocSlabs(a__,b__,c__,d__) HANDLE_ERROR( cudaPreAlloc(a__,b__,c__,d__) )
     #define CudaAllocFinalize() HANDLE_ERROR( cudaAllocFinalize() )
     #define CudaMallocHost(a__,b__) HANDLE_ERROR( cudaMallocHost(a__,b__) )
     #define CudaFree(a__) HANDLE_ERROR( cudaFree(a__) )
@@ -132,6 +136,7 @@
 
     #define CudaMemcpyDeviceToHost hipMemcpyDeviceToHost
     #define CudaMemcpyHostToDevice hipMemcpyHostToDevice
+    #define CudaMemcpyDeviceToDevice hipMemcpyDeviceToDevice
     #define CudaCopyToConstant(a__,b__,c__,d__) HANDLE_ERROR( hipMemcpyToSymbol(b__, c__, d__, 0, hipMemcpyHostToDevice))
     #define CudaMemcpy2D(a__,b__,c__,d__,e__,f__,g__) HANDLE_ERROR( hipMemcpy2D(a__, b__, c__, d__, e__, f__, g__) )
     #define CudaMemcpy(a__,b__,c__,d__) HANDLE_ERROR( hipMemcpy(a__, b__, c__, d__) )
@@ -143,8 +148,11 @@
       #define CudaMemcpyPeerAsync(a__,b__,c__,d__,e__,f__) HANDLE_ERROR( hipMemcpyPeerAsync(a__, b__, c__, d__, e__, f__) )
     #endif
     #define CudaMemset(a__,b__,c__) HANDLE_ERROR( hipMemset(a__, b__, c__) )
+    #define CudaFirstTouch(a__,b__) CudaMemset(a__, 0, b__)
+    #define CudaFirstTouchSlabs(a__,b__,c__,d__) CudaMemset(a__, 0, b__)
     #define CudaMalloc(a__,b__) HANDLE_ERROR( hipMalloc(a__,b__) )
     #define CudaPreAlloc(a__,b__) HANDLE_ERROR( cudaPreAlloc(a__,b__) )
+    #define CudaPreAllocSlabs(a__,b__,c__,d__) HANDLE_ERROR( cudaPreAlloc(a__,b__,c__,d__) )
     #define CudaAllocFinalize() HANDLE_ERROR( cudaAllocFinalize() )
     #define CudaMallocHost(a__,b__) HANDLE_ERROR( hipHostMalloc(a__,b__) )
     #define CudaFree(a__) HANDLE_ERROR( hipFree(a__) )
@@ -220,6 +228,7 @@
     #define CudaError int
     #define CudaSuccess -1
     #define CudaPreAlloc(a__,b__) HANDLE_ERROR( cudaPreAlloc(a__,b__) )
+    #define CudaPreAllocSlabs(a__,b__,c__,d__) HANDLE_ERROR( cudaPreAlloc(a__,b__,c__,d__) )
     #define CudaAllocFinalize() HANDLE_ERROR( cudaAllocFinalize() )
     #define CudaAllocFreeAll() HANDLE_ERROR( cudaAllocFreeAll() )
 
@@ -247,9 +256,11 @@
     #define CudaMemcpy(a__,b__,c__,d__) memcpy(a__, b__, c__)
     #define CudaMemcpyAsync(a__,b__,c__,d__,e__) CudaMemcpy(a__, b__, c__, d__)
     #define CudaMemset(a__,b__,c__) memset(a__, b__, c__)
-    #define CudaMalloc(a__,b__) assert( (*((void**)(a__)) = malloc(b__)) != NULL )
+    #define CudaFirstTouch(a__,b__) CpuFirstTouch(a__, b__, 1, 1)
+    #define CudaFirstTouchSlabs(a__,b__,c__,d__) CpuFirstTouch(a__, b__, c__, d__)
+    #define CudaMalloc(a__,b__) assert( (*((void**)(a__)) = CpuMalloc(b__)) != NULL )
     #define CudaMallocHost(a__,b__) assert( (*((void**)(a__)) = malloc(b__)) != NULL )
-    #define CudaFree(a__) free(a__)
+    #define CudaFree(a__) CpuFree(a__)
     #define CudaFreeHost(a__) free(a__)
 
 
@@ -274,20 +285,118 @@
     #define CudaDeviceReset()
 
     #define RunKernelMaxThreads 1
-    extern uint3 CpuBlock;
+    #ifdef CROSS_CPU_SIMD
+      #define CPU_SIMD_LANES 16 ///< Nodes of an interior row run together (and accumulators of a row with reductions)
+      #define CudaSimdLanes _Pragma("omp simd")
+      #define CudaSimdFlatten __attribute__((flatten)) ///< Inline the whole node into its vector versions
+    #endif
     #ifdef CROSS_OPENMP
-      #pragma omp threadprivate(CpuBlock)
+      extern thread_local uint3 CpuBlock; // also used by the threads of CpuTeam
+      extern thread_local int CpuRow; // reduction row of the group of blocks being run (-1: row of the thread)
+    #else
+      extern uint3 CpuBlock;
     #endif
     extern uint3 CpuThread;
     extern uint3 CpuSize;
 
     #include <functional>
+    #include <vector>
+    #include <atomic>
+
+    /// Tiling of the block grid in CPUKernelRun
+    /**
+      Tiles cover x and y of the block grid (the y/z plane of the lattice).
+      Zero size means no tiling.
+    */
+    struct CpuTiling {
+      unsigned int x, y;
+      bool morton; ///< Walk the tiles in Morton (Z-curve) order
+    };
+    extern CpuTiling CpuTile;
+
+    /// Placement of the CPU memory
+    struct CpuMemoryMode {
+      bool first_touch; ///< Zero the buffers with the static partition of CPUKernelRun
+      int huge_pages; ///< One of CPU_HUGE_*
+    };
+    #define CPU_HUGE_NO 0
+    #define CPU_HUGE_TRANSPARENT 1
+    #define CPU_HUGE_EXPLICIT 2
+    extern CpuMemoryMode CpuMemory;
+    void * CpuMalloc(size_t size);
+    void CpuFree(void * ptr);
+    void CpuFirstTouch(void * ptr, size_t size, size_t fields, size_t nz);
+    const unsigned int * CpuTileOrder(unsigned int ntx, unsigned int nty);
+    size_t CpuCacheSize(int level);
+    unsigned int CpuTileAuto(size_t row_size);
+
+    /// Work driven by the master thread during CPU kernels
+    /**
+      If set, it is called repeatedly until it returns true
+      (used for progressing the MPI exchange during the interior kernel).
+    */
+    extern std::function<bool()> CpuProgress;
+    extern bool CpuProgressAllowed; ///< MPI can be called inside the CPU kernels (MPI_THREAD_FUNNELED provided)
+
+    /// Number of groups of blocks per thread in the kernels with progress work
+    /**
+      The groups are fixed (static ranges of tiles) and handed out to the
+      threads dynamically. Each group has its own reduction row, so the
+      Globals do not depend on which thread ran which group.
+    */
+    #define CPU_PROGRESS_GROUPS 4
+
+    /// Settings of the persistent thread team (used only with OpenMP)
+    struct CpuTeamMode {
+      bool enabled; ///< Start the team with the Lattice
+      bool pin; ///< Bind the workers to CPUs
+    };
+    extern CpuTeamMode CpuTeamConf;
 
+    #ifdef CROSS_OPENMP
+    /// Persistent team of (pinned) threads running the CPU kernels
+    /**
+      Started with the Lattice, it replaces the fork-join of an OpenMP
+      parallel region in every kernel launch. Without progress work each
+      thread always gets the same part of the block grid, so it stays on
+      the same tiles (and memory) across iterations.
+    */
+    void CpuTeamStart(int n, bool pin);
+    void CpuTeamStop();
+    int CpuTeamSize(); ///< Number of threads in the team (0 if not started)
+    void CpuTeamRun(void (*fn)(void *, int, int), void * ctx);
+    extern thread_local int CpuTeamRank; ///< Rank of a team thread (0 for the master and the OpenMP threads)
+    template <class J> void CpuTeamCall(void * job, int rank, int size) { (*(J*) job)(rank, size); }
+    #endif
+
+    inline int CpuThreadNumber() {
+      #ifdef CROSS_OPENMP
+        if (CpuTeamRank > 0) return CpuTeamRank;
+        return omp_get_thread_num();
+      #else
+        return 0;
+      #endif
+    }
+
+    inline int CpuThreadCount() {
+      #ifdef CROSS_OPENMP
+        if (CpuTeamSize() > omp_get_max_threads()) return CpuTeamSize();
+        return omp_get_max_threads();
+      #else
+        return 1;
+      #endif
+    }
+
+    #ifdef CROSS_OPENMP
+
+    /// Run the blocks of one tile (or one row of blocks if not tiled)
     template <typename F, typename ...P>
-    inline void CPUKernelRun(F &&func, const dim3& blocks, P &&... args) {
-      #pragma omp parallel for collapse(3) schedule(static)
-      for (unsigned int y = 0; y < blocks.y; y++)
-        for (unsigned int x = 0; x < blocks.x; x++)
+    inline void CPUKernelRunUnit(unsigned int o, unsigned int ntx, unsigned int sx, unsigned int sy, F &&func, const dim3& blocks, P &&... args) {
+      const unsigned int tx = o % ntx, ty = o / ntx;
+      const unsigned int x1 = (tx+1)*sx < blocks.x ? (tx+1)*sx : blocks.x;
+      const unsigned int y1 = (ty+1)*sy < blocks.y ? (ty+1)*sy : blocks.y;
+      for (unsigned int y = ty*sy; y < y1; y++)
+        for (unsigned int x = tx*sx; x < x1; x++)
           for (unsigned int z = 0; z < blocks.z; z++) {
             CpuBlock.x = x;
             CpuBlock.y = y;
@@ -296,6 +405,109 @@
       }
     }
 
+    /// Run a fixed group of tiles (or rows of blocks) with its own reduction row
+    template <typename F, typename ...P>
+    inline void CPUKernelRunGroup(unsigned int g, unsigned int groups, const unsigned int * order, unsigned long long int units, unsigned int ntx, unsigned int sx, unsigned int sy, F &&func, const dim3& blocks, P &&... args) {
+      CpuRow = g;
+      for (unsigned long long int t = units*g/groups; t < units*(g+1)/groups; t++)
+        CPUKernelRunUnit(order ? order[t] : t, ntx, sx, sy, func, blocks, args...);
+      CpuRow = -1;
+    }
+
+    /// Run a kernel while the master thread drives CpuProgress
+    /**
+      The master thread joins the computation only after CpuProgress is done.
+      Groups of tiles (or rows of blocks) are handed out dynamically, so the
+      other threads take over its share in the meantime.
+    */
+    template <typename F, typename ...P>
+    inline void CPUKernelRunProgress(F &&func, const dim3& blocks, P &&... args) {
+      const bool tiled = CpuTile.x > 0 && CpuTile.y > 0;
+      const unsigned int sx = tiled ? CpuTile.x : 1, sy = tiled ? CpuTile.y : 1;
+      const unsigned int ntx = (blocks.x + sx - 1) / sx;
+      const unsigned int nty = (blocks.y + sy - 1) / sy;
+      const unsigned int * order = tiled ? CpuTileOrder(ntx, nty) : NULL;
+      const unsigned long long int units = ntx*nty;
+      const unsigned int groups = CpuThreadCount() * CPU_PROGRESS_GROUPS;
+      #pragma omp parallel
+      {
+        if (omp_get_thread_num() == 0) while (!CpuProgress()) {}
+        #pragma omp for schedule(dynamic) nowait
+        for (unsigned int g = 0; g < groups; g++) {
+          CPUKernelRunGroup(g, groups, order, units, ntx, sx, sy, func, blocks, args...);
+        }
+      }
+    }
+
+    /// Run a kernel on the persistent team
+    template <typename F, typename ...P>
+    inline void CPUKernelRunTeam(F &&func, const dim3& blocks, P &&... args) {
+      const bool tiled = CpuTile.x > 0 && CpuTile.y > 0;
+      const unsigned int sx = tiled ? CpuTile.x : 1, sy = tiled ? CpuTile.y : 1;
+      const unsigned int ntx = (blocks.x + sx - 1) / sx;
+      const unsigned int nty = (blocks.y + sy - 1) / sy;
+      const unsigned int * order = tiled ? CpuTileOrder(ntx, nty) : NULL;
+      const unsigned long long int units = ntx*nty;
+      const bool progress = (bool) CpuProgress;
+      const unsigned int groups = CpuThreadCount() * CPU_PROGRESS_GROUPS;
+      std::atomic<unsigned int> next(0);
+      auto job = [&](int rank, int size) {
+        if (progress) {
+          if (rank == 0) while (!CpuProgress()) {}
+          for (unsigned int g = next++; g < groups; g = next++)
+            CPUKernelRunGroup(g, groups, order, units, ntx, sx, sy, func, blocks, args...);
+        } else {
+          for (unsigned int t = units*rank/size; t < units*(rank+1)/size; t++)
+            CPUKernelRunUnit(order ? order[t] : t, ntx, sx, sy, func, blocks, args...);
+        }
+      };
+      CpuTeamRun(&CpuTeamCall< decltype(job) >, &job);
+    }
+    #endif
+
+    template <typename F, typename ...P>
+    inline void CPUKernelRun(F &&func, const dim3& blocks, P &&... args) {
+      #ifdef CROSS_OPENMP
+      if (CpuTeamSize() > 1) {
+        CPUKernelRunTeam(func, blocks, std::forward<P>(args)...);
+        return;
+      }
+      if (CpuProgress && omp_get_max_threads() > 1) {
+        CPUKernelRunProgress(func, blocks, std::forward<P>(args)...);
+        return;
+      }
+      #endif
+      if (CpuTile.x == 0 || CpuTile.y == 0) {
+        #pragma omp parallel for collapse(3) schedule(static)
+        for (unsigned int y = 0; y < blocks.y; y++)
+          for (unsigned int x = 0; x < blocks.x; x++)
+            for (unsigned int z = 0; z < blocks.z; z++) {
+              CpuBlock.x = x;
+              CpuBlock.y = y;
+              CpuBlock.z = z;
+              func(std::forward<P>(args)...);
+        }
+        return;
+      }
+      const unsigned int ntx = (blocks.x + CpuTile.x - 1) / CpuTile.x;
+      const unsigned int nty = (blocks.y + CpuTile.y - 1) / CpuTile.y;
+      const unsigned int * order = CpuTileOrder(ntx, nty);
+      #pragma omp parallel for schedule(static)
+      for (unsigned int t = 0; t < ntx*nty; t++) {
+        const unsigned int tx = order[t] % ntx, ty = order[t] / ntx;
+        const unsigned int x1 = (tx+1)*CpuTile.x < blocks.x ? (tx+1)*CpuTile.x : blocks.x;
+        const unsigned int y1 = (ty+1)*CpuTile.y < blocks.y ? (ty+1)*CpuTile.y : blocks.y;
+        for (unsigned int y = ty*CpuTile.y; y < y1; y++)
+          for (unsigned int x = tx*CpuTile.x; x < x1; x++)
+            for (unsigned int z = 0; z < blocks.z; z++) {
+              CpuBlock.x = x;
+              CpuBlock.y = y;
+              CpuBlock.z = z;
+              func(std::forward<P>(args)...);
+        }
+      }
+    }
+
     template <typename F, typename ...P>
     inline void CudaKernelRun(F &&func, const dim3& blocks, const dim3& threads, P &&... args) {
       CPUKernelRun(func, blocks, std::forward<P>(args)...);
@@ -341,11 +553,46 @@
       for (unsigned char i = 0; i < LEN; i ++) CudaAtomicAdd(&sum[i], val[i]);
     }
 
+    /// Per-thread accumulators for reductions in CPU kernels
+    /**
+      Each thread (or each group of blocks in the kernels with progress work)
+      accumulates to its own (cache line padded) row of slots.
+      After the kernel the rows are combined pairwise in a fixed order,
+      so the result does not depend on the timing of the threads.
+    */
+    template <typename T> class CpuReduction {
+      std::vector<T> buf;
+      size_t slots, stride;
+      int rows;
+    public:
+      inline CpuReduction() : slots(0), stride(0), rows(0) {};
+      inline void Start(size_t n) {
+        slots = n;
+        stride = (n*sizeof(T) + 63) / 64 * 64 / sizeof(T);
+        if (stride < 1) stride = 1;
+        rows = CpuThreadCount() * CPU_PROGRESS_GROUPS;
+        buf.assign(stride*rows, T(0));
+      }
+      inline T * Row() {
+        #ifdef CROSS_OPENMP
+          if (CpuRow >= 0) return &buf[CpuRow*stride];
+        #endif
+        return &buf[CpuThreadNumber()*stride];
+      }
+      template <class OP> inline const T * Reduce(OP op) {
+        for (int step = 1; step < rows; step *= 2)
+          for (int t = 0; t + step < rows; t += 2*step)
+            for (size_t i = 0; i < slots; i++)
+              buf[t*stride + i] = op(i, buf[t*stride + i], buf[(t+step)*stride + i]);
+        return buf.data();
+      }
+    };
+
   #define ISFINITE(l__) std::isfinite(l__)
 
   #endif
 
-  CudaError cudaPreAlloc(void ** ptr, size_t size);
+  CudaError cudaPreAlloc(void ** ptr, size_t size, size_t fields = 1, size_t nz = 1);
   CudaError cudaAllocFinalize();
   CudaError cudaAllocFreeAll();
 
@@ -9,6 +9,8 @@
 #ifdef WITH_HDF5
 	#include <hdf5.h>
 #endif
+#include <map>
+#include <vector>
 
 std::string NameXPath(const pugi::xml_node& node) {
 	std::string path;
@@ -23,7 +25,67 @@ std::string NameXPath(const pugi::xml_node& node) {
 	return path;
 }
 
-int hdf5WriteLattice(const char * nm, Solver * solver, name_set * what, unsigned long int * chunkdim_, unsigned int options, lbRegion total_output_reg)
+/// Append the Geometry and Topology of the output region to a XDMF grid
+void hdf5XdmfGeometry(pugi::xml_node xdmf_grid, Solver * solver, unsigned int options, lbRegion total_output_reg)
+{
+	Glue glue;
+	Lattice * lattice = solver->lattice;
+	double unit = solver->units.alt("1m");
+	pugi::xml_node xdmf_geometry = xdmf_grid.append_child("Geometry");
+	xdmf_geometry.append_attribute("Origin") = "";
+	xdmf_geometry.append_attribute("Type") = "ORIGIN_DXDYDZ";
+	pugi::xml_node xdmf_dataitem;
+	xdmf_dataitem = xdmf_geometry.append_child("DataItem");
+	xdmf_dataitem.append_attribute("DataType") = "Float";
+	xdmf_dataitem.append_attribute("Dimensions") = "3";
+	xdmf_dataitem.append_attribute("Format") = "XML";
+	xdmf_dataitem.append_attribute("Precision") = 8;
+	{
+		double shift = 0.0;
+		if (options & HDF5_WRITE_POINT) shift = 0.5;
+		xdmf_dataitem.append_child(pugi::node_pcdata).set_value(glue(" ") << (lattice->pz + shift + total_output_reg.dz)/unit << (lattice->py + shift + total_output_reg.dy)/unit << (lattice->px + shift + total_output_reg.dx)/unit);
+	}
+	xdmf_dataitem = xdmf_geometry.append_child("DataItem");
+	xdmf_dataitem.append_attribute("DataType") = "Float";
+	xdmf_dataitem.append_attribute("Dimensions") = "3";
+	xdmf_dataitem.append_attribute("Format") = "XML";
+	xdmf_dataitem.append_attribute("Precision") = 8;
+	xdmf_dataitem.append_child(pugi::node_pcdata).set_value(glue(" ") << 1/unit << 1/unit << 1/unit);
+
+	int totaldim[3], totalpointdim[3];
+	totaldim[0] = total_output_reg.nz;
+	totaldim[1] = total_output_reg.ny;
+	totaldim[2] = total_output_reg.nx;
+	for (int i=0; i<3; i++) totalpointdim[i] = totaldim[i] + 1;
+	pugi::xml_node xdmf_topology = xdmf_grid.append_child("Topology");
+	if (options & HDF5_WRITE_POINT) {
+		xdmf_topology.append_attribute("Dimensions") = glue(" ") << std::make_pair(totaldim,3);
+	} else {
+		xdmf_topology.append_attribute("Dimensions") = glue(" ") << std::make_pair(totalpointdim,3);
+	}
+	xdmf_topology.append_attribute("Type") = "3DCoRectMesh";
+}
+
+/// Round a quantity to its error bound (no-op without bounds)
+/**
+	Collective, as the range of the quantity is reduced over all the processes.
+	The values are converted to the output type after the rounding, so the
+	bound leaves room for the epsilon of the coarser of the two types.
+	\param output_precision Size of the written floating point type (4 or 8)
+	\return Rounding step (0 - lossless)
+*/
+static double hdf5LossyRound(const ErrorBounds * bounds, const std::string& name, real_t * data, size_t n, int output_precision)
+{
+	if (bounds == NULL || bounds->empty()) return 0;
+	double min;
+	double eps = std::numeric_limits<real_t>::epsilon();
+	if (output_precision < (int) sizeof(real_t)) eps = std::numeric_limits<float>::epsilon();
+	double step = LossyStep(*bounds, name, data, n, MPMD.local, min, eps);
+	LossyRound(data, n, step);
+	return step;
+}
+
+int hdf5WriteLattice(const char * nm, Solver * solver, name_set * what, unsigned long int * chunkdim_, unsigned int options, lbRegion total_output_reg, const ErrorBounds * bounds)
 {
 #ifdef WITH_HDF5
 	Glue glue;
@@ -46,7 +108,7 @@ int hdf5WriteLattice(const char * nm, Solver * solver, name_set * what, unsigned
 	lbRegion reg = local_reg.intersect(total_output_reg);
 	size = reg.size();
 
-	myprint(1,-1,"Writing region %dx%dx%d + %d,%d,%d (size %d) from %dx%dx%d + %d,%d,%d", 
+	myprint(1,-1,"Writing region %dx%dx%d + %d,%d,%d (size %ld) from %dx%dx%d + %d,%d,%d", 
 		reg.nx,reg.ny,reg.nz,reg.dx,reg.dy,reg.dz, size,
 		local_reg.nx,local_reg.ny,local_reg.nz,local_reg.dx,local_reg.dy,local_reg.dz);
 
@@ -60,27 +122,9 @@ int hdf5WriteLattice(const char * nm, Solver * solver, name_set * what, unsigned
 	pugi::xml_node xdmf_time = xdmf_grid.append_child("Time");
 	unit = units->alt("1s");
 	xdmf_time.append_attribute("Value") = solver->iter / unit;
-	pugi::xml_node xdmf_geometry = xdmf_grid.append_child("Geometry");
-	xdmf_geometry.append_attribute("Origin") = "";
-	xdmf_geometry.append_attribute("Type") = "ORIGIN_DXDYDZ";
+	hdf5XdmfGeometry(xdmf_grid, solver, options, total_output_reg);
 	pugi::xml_node xdmf_dataitem;
 	unit = units->alt("1m");
-	xdmf_dataitem = xdmf_geometry.append_child("DataItem");
-	xdmf_dataitem.append_attribute("DataType") = "Float";
-	xdmf_dataitem.append_attribute("Dimensions") = "3";
-	xdmf_dataitem.append_attribute("Format") = "XML";
-	xdmf_dataitem.append_attribute("Precision") = 8;
-	{
-		double shift = 0.0;
-		if (options & HDF5_WRITE_POINT) shift = 0.5;
-		xdmf_dataitem.append_child(pugi::node_pcdata).set_value(glue(" ") << (lattice->pz + shift + total_output_reg.dz)/unit << (lattice->py + shift + total_output_reg.dy)/unit << (lattice->px + shift + total_output_reg.dx)/unit);
-	}
-	xdmf_dataitem = xdmf_geometry.append_child("DataItem");
-	xdmf_dataitem.append_attribute("DataType") = "Float";
-	xdmf_dataitem.append_attribute("Dimensions") = "3";
-	xdmf_dataitem.append_attribute("Format") = "XML";
-	xdmf_dataitem.append_attribute("Precision") = 8;
-	xdmf_dataitem.append_child(pugi::node_pcdata).set_value(glue(" ") << 1/unit << 1/unit << 1/unit);
 	
 	hid_t       file_id, dset_id;         /* file and dataset identifiers */
 	hsize_t     totaldim[4];                 /* dataset dimensions */
@@ -134,14 +178,6 @@ int hdf5WriteLattice(const char * nm, Solver * solver, name_set * what, unsigned
 		chunkdim[3] = totaldim[3];
 	}					
 
-	pugi::xml_node xdmf_topology = xdmf_grid.append_child("Topology");
-	if (options & HDF5_WRITE_POINT) {
-		xdmf_topology.append_attribute("Dimensions") = glue(" ") << std::make_pair(totaldim,3);
-	} else {
-		xdmf_topology.append_attribute("Dimensions") = glue(" ") << std::make_pair(totalpointdim,3);
-	}
-	xdmf_topology.append_attribute("Type") = "3DCoRectMesh";
-
 	pugi::xml_node xdmf_attribute;
 
 	myprint(2,-1,"hdf5 file: %s\n   domain: %lldx%lldx%lld chunks: %lldx%lldx%lld local: %lldx%lldx%lld+%lld,%lld,%lld\n",
@@ -259,6 +295,8 @@ int hdf5WriteLattice(const char * nm, Solver * solver, name_set * what, unsigned
 			
 			status = H5Pset_chunk (plist_id, rank, chunkdim);
 			if (status < 0) return H5Eprint1(stderr);
+			if ((options & HDF5_DEFLATE) && bounds != NULL && !bounds->empty()) status = H5Pset_shuffle (plist_id);
+			if (status < 0) return H5Eprint1(stderr);
 			if (options & HDF5_DEFLATE) status = H5Pset_deflate (plist_id, 6);
 			if (status < 0) return H5Eprint1(stderr);
 			dset_id = H5Dcreate2(file_id, fieldname, output_type, filespace, H5P_DEFAULT, plist_id, H5P_DEFAULT);
@@ -276,6 +314,7 @@ int hdf5WriteLattice(const char * nm, Solver * solver, name_set * what, unsigned
 			if (vector) comp = 3;
 	                real_t* tmp = new real_t[size*comp];
                         lattice->GetQuantity(it.id, reg, tmp, 1/unit);
+			hdf5LossyRound(bounds, it.name, tmp, size*comp, output_precision);
 
 			myprint(0,-1,"filespace: %lld memsize: %lld\n", H5Sget_select_npoints(filespace), H5Sget_select_npoints(memspace));
 			plist_id = H5Pcreate(H5P_DATASET_XFER);
@@ -337,3 +376,380 @@ int hdf5WriteLattice(const char * nm, Solver * solver, name_set * what, unsigned
 	return -1;
 #endif
 }
+
+#ifdef WITH_HDF5
+/// One HDF5 file with all the dumps of a run
+/**
+	Every dataset has an unlimited first (time) dimension, extended by one
+	at each dump. The file and the datasets stay open between the dumps, and
+	the XDMF temporal collection pointing to the steps is rewritten on each dump.
+*/
+struct hdf5TimeSeries {
+	/// Attribute of the XDMF grids
+	struct Attr {
+		std::string name;
+		bool vector;
+		int precision;
+		double unit;
+	};
+	hid_t file_id;
+	hid_t time_id; ///< Dataset with the times of the dumps
+	std::map< std::string, hid_t > dsets; ///< Open datasets by name
+	std::vector< Attr > attrs;
+	std::vector< double > times; ///< Times of the dumps [s]
+	std::string filename, basename;
+	const ErrorBounds * bounds; ///< Error bounds of the quantities (NULL - lossless)
+	lbRegion reg;
+	hsize_t chunkdim[3];
+	unsigned int options;
+};
+
+/// Get (or create) an extendible dataset of the time series
+/**
+	The dataset chunk cache holds all the chunks of the local region,
+	so a chunk is never evicted before it is completely written.
+*/
+static hid_t hdf5SeriesDataset(hdf5TimeSeries * series, const lbRegion& local_reg, const char * fieldname, hid_t output_type, int rank, bool lossy)
+{
+	std::map< std::string, hid_t >::iterator it = series->dsets.find(fieldname);
+	if (it != series->dsets.end()) return it->second;
+	hsize_t totaldim[5], maxdim[5], chunkdim[5];
+	totaldim[0] = 0;
+	totaldim[1] = series->reg.nz;
+	totaldim[2] = series->reg.ny;
+	totaldim[3] = series->reg.nx;
+	totaldim[4] = 3;
+	chunkdim[0] = 1;
+	for (int i=0; i<3; i++) chunkdim[i+1] = series->chunkdim[i];
+	chunkdim[4] = 3;
+	for (int i=0; i<5; i++) maxdim[i] = totaldim[i];
+	maxdim[0] = H5S_UNLIMITED;
+
+	hsize_t local_dim[3];
+	local_dim[0] = local_reg.nz;
+	local_dim[1] = local_reg.ny;
+	local_dim[2] = local_reg.nx;
+	size_t nchunks = 1;
+	for (int i=0; i<3; i++) nchunks *= (local_dim[i] + chunkdim[i+1] - 1) / chunkdim[i+1] + 1;
+	size_t chunksize = H5Tget_size(output_type);
+	for (int i=1; i<rank; i++) chunksize *= chunkdim[i];
+
+	herr_t status;
+	hid_t filespace = H5Screate_simple(rank, totaldim, maxdim);
+	hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+	status = H5Pset_chunk(dcpl_id, rank, chunkdim);
+	if (status >= 0 && (series->options & HDF5_DEFLATE) && lossy) status = H5Pset_shuffle(dcpl_id);
+	if (status >= 0 && (series->options & HDF5_DEFLATE)) status = H5Pset_deflate(dcpl_id, 6);
+	hid_t dapl_id = H5Pcreate(H5P_DATASET_ACCESS);
+	if (status >= 0) status = H5Pset_chunk_cache(dapl_id, 10*nchunks+1, nchunks*chunksize, 1.0);
+	hid_t dset_id = -1;
+	if (status >= 0) dset_id = H5Dcreate2(series->file_id, fieldname, output_type, filespace, H5P_DEFAULT, dcpl_id, dapl_id);
+	H5Pclose(dapl_id);
+	H5Pclose(dcpl_id);
+	H5Sclose(filespace);
+	if (dset_id < 0) {
+		H5Eprint1(stderr);
+		return -1;
+	}
+	series->dsets[fieldname] = dset_id;
+	return dset_id;
+}
+
+/// Extend a dataset by one step and write the local part of the last step
+static int hdf5SeriesWrite(hid_t dset_id, int rank, hsize_t * totaldim, hsize_t * dim, hsize_t * offset, hid_t input_type, const void * data)
+{
+	hsize_t ones[5] = {1, 1, 1, 1, 1};
+	herr_t status = H5Dset_extent(dset_id, totaldim);
+	if (status < 0) {
+		H5Eprint1(stderr);
+		return -1;
+	}
+	hid_t filespace = H5Dget_space(dset_id);
+	hid_t memspace = H5Screate_simple(rank, dim, NULL);
+	bool empty = false;
+	for (int i=0; i<rank; i++) if (dim[i] == 0) empty = true;
+	if (empty) {
+		status = H5Sselect_none(filespace);
+		if (status >= 0) status = H5Sselect_none(memspace);
+	} else {
+		status = H5Sselect_hyperslab(filespace, H5S_SELECT_SET, offset, ones, ones, dim);
+	}
+	if (status >= 0) {
+		hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
+		H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE);
+		status = H5Dwrite(dset_id, input_type, memspace, filespace, plist_id, data);
+		H5Pclose(plist_id);
+	}
+	H5Sclose(memspace);
+	H5Sclose(filespace);
+	if (status < 0) {
+		H5Eprint1(stderr);
+		return -1;
+	}
+	return 0;
+}
+
+/// Write the XDMF temporal collection of all the dumps in the series
+static int hdf5SeriesXdmf(hdf5TimeSeries * series, Solver * solver, const char * filename)
+{
+	Glue glue;
+	pugi::xml_document xdmf_doc;
+	pugi::xml_node xdmf_main = xdmf_doc.append_child("Xdmf");
+	xdmf_main.append_attribute("xmlns:xi") = "http://www.w3.org/2001/XInclude";
+	xdmf_main.append_attribute("Version") = "3.0";
+	pugi::xml_node xdmf_domain = xdmf_main.append_child("Domain");
+	pugi::xml_node xdmf_series = xdmf_domain.append_child("Grid");
+	xdmf_series.append_attribute("Name") = "Lattice";
+	xdmf_series.append_attribute("GridType") = "Collection";
+	xdmf_series.append_attribute("CollectionType") = "Temporal";
+	hsize_t nt = series->times.size();
+	hsize_t totaldim[4];
+	totaldim[0] = series->reg.nz;
+	totaldim[1] = series->reg.ny;
+	totaldim[2] = series->reg.nx;
+	totaldim[3] = 3;
+	for (hsize_t t = 0; t < nt; t++) {
+		pugi::xml_node xdmf_grid = xdmf_series.append_child("Grid");
+		xdmf_grid.append_attribute("Name") = (glue() << "Lattice" << t).c_str();
+		xdmf_grid.append_attribute("GridType") = "Uniform";
+		pugi::xml_node xdmf_time = xdmf_grid.append_child("Time");
+		xdmf_time.append_attribute("Value") = series->times[t];
+		hdf5XdmfGeometry(xdmf_grid, solver, series->options, series->reg);
+		for (const hdf5TimeSeries::Attr& it : series->attrs) {
+			int rank = 3;
+			if (it.vector) rank = 4;
+			pugi::xml_node xdmf_attribute = xdmf_grid.append_child("Attribute");
+			if (series->options & HDF5_WRITE_POINT) {
+				xdmf_attribute.append_attribute("Center") = "Node";
+			} else {
+				xdmf_attribute.append_attribute("Center") = "Cell";
+			}
+			if (it.vector) xdmf_attribute.append_attribute("AttributeType") = "Vector";
+			xdmf_attribute.append_attribute("Name") = it.name.c_str();
+			pugi::xml_node xdmf_hyperslab = xdmf_attribute.append_child("DataItem");
+			xdmf_hyperslab.append_attribute("ItemType") = "HyperSlab";
+			xdmf_hyperslab.append_attribute("Dimensions") = glue(" ") << 1 << std::make_pair(totaldim, rank);
+			xdmf_hyperslab.append_attribute("Type") = "HyperSlab";
+			pugi::xml_node xdmf_dataitem = xdmf_hyperslab.append_child("DataItem");
+			xdmf_dataitem.append_attribute("Dimensions") = glue(" ") << 3 << rank+1;
+			xdmf_dataitem.append_attribute("Format") = "XML";
+			{
+				int zeros[4] = {0, 0, 0, 0};
+				int ones[4] = {1, 1, 1, 1};
+				std::string slab = (glue(" ") << t << std::make_pair(zeros, rank)).str();
+				slab = slab + "\n" + (glue(" ") << 1 << std::make_pair(ones, rank)).str();
+				slab = slab + "\n" + (glue(" ") << 1 << std::make_pair(totaldim, rank)).str();
+				xdmf_dataitem.append_child(pugi::node_pcdata).set_value(slab.c_str());
+			}
+			xdmf_dataitem = xdmf_hyperslab.append_child("DataItem");
+			xdmf_dataitem.append_attribute("DataType") = "Float";
+			xdmf_dataitem.append_attribute("Dimensions") = (glue(" ") << nt << std::make_pair(totaldim, rank)).c_str();
+			xdmf_dataitem.append_attribute("Format") = "HDF";
+			xdmf_dataitem.append_attribute("Precision") = it.precision;
+			xdmf_dataitem.append_child(pugi::node_pcdata).set_value(glue(":/") << series->basename << it.name);
+			if (series->options & HDF5_WRITE_LBM) {
+				xdmf_attribute = xdmf_grid.append_child("Attribute");
+				if (series->options & HDF5_WRITE_POINT) {
+					xdmf_attribute.append_attribute("Center") = "Node";
+				} else {
+					xdmf_attribute.append_attribute("Center") = "Cell";
+				}
+				if (it.vector) xdmf_attribute.append_attribute("AttributeType") = "Vector";
+				xdmf_attribute.append_attribute("Name") = glue("_") << it.name << "LB";
+				xdmf_dataitem = xdmf_attribute.append_child("DataItem");
+				xdmf_dataitem.append_attribute("ItemType") = "Function";
+				xdmf_dataitem.append_attribute("Function") = glue(" ") << it.unit << "*" << "$0";
+				xdmf_dataitem.append_attribute("Dimensions") = glue(" ") << 1 << std::make_pair(totaldim, rank);
+				xdmf_dataitem.append_copy(xdmf_hyperslab);
+			}
+		}
+	}
+	if (!xdmf_doc.save_file(filename)) {
+		ERROR("Failed to write %s\n", filename);
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+/// Open a HDF5 file for all the dumps of the run
+/**
+	The file is opened collectively, with the metadata operations and writes
+	done collectively (HDF5 1.10 and newer).
+	\return The series (NULL on error), to be closed with hdf5CloseTimeSeries
+*/
+hdf5TimeSeries * hdf5OpenTimeSeries(const char * nm, Solver * solver, unsigned long int * chunkdim_, unsigned int options, lbRegion total_output_reg, const ErrorBounds * bounds)
+{
+#ifdef WITH_HDF5
+	char filename[2*STRING_LEN];
+	solver->outCollectiveFile(nm, ".h5", filename);
+	hdf5TimeSeries * series = new hdf5TimeSeries;
+	series->filename = filename;
+	series->basename = filename;
+	size_t slash = series->basename.rfind('/');
+	if (slash != std::string::npos) series->basename = series->basename.substr(slash+1);
+	series->reg = total_output_reg;
+	series->options = options;
+	series->bounds = bounds;
+	for (int i=0; i<3; i++) {
+		if (chunkdim_ != NULL) {
+			series->chunkdim[i] = chunkdim_[i];
+		} else {
+			series->chunkdim[i] = 1;
+		}
+	}
+
+	hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
+	H5Pset_fapl_mpio(plist_id, MPMD.local, MPI_INFO_NULL);
+#if H5_VERSION_GE(1,10,0)
+	H5Pset_all_coll_metadata_ops(plist_id, true);
+	H5Pset_coll_metadata_write(plist_id, true);
+#endif
+	series->file_id = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, plist_id);
+	H5Pclose(plist_id);
+	if (series->file_id < 0) {
+		H5Eprint1(stderr);
+		ERROR("Failed to create %s\n", filename);
+		delete series;
+		return NULL;
+	}
+
+	hsize_t dim = 0, maxdim = H5S_UNLIMITED, chunkdim = 64;
+	hid_t filespace = H5Screate_simple(1, &dim, &maxdim);
+	plist_id = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_chunk(plist_id, 1, &chunkdim);
+	series->time_id = H5Dcreate2(series->file_id, "Time", H5T_NATIVE_DOUBLE, filespace, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+	H5Pclose(plist_id);
+	H5Sclose(filespace);
+	if (series->time_id < 0) {
+		H5Eprint1(stderr);
+		H5Fclose(series->file_id);
+		delete series;
+		return NULL;
+	}
+	output("Writing HDF5 time series to %s\n", filename);
+	return series;
+#else
+	ERROR("No HDF5 support\n");
+	return NULL;
+#endif
+}
+
+/// Append a dump to the HDF5 time series
+int hdf5WriteTimeSeries(hdf5TimeSeries * series, Solver * solver, name_set * what)
+{
+#ifdef WITH_HDF5
+	Lattice * lattice = solver->lattice;
+	UnitEnv * units = &solver->units;
+	solver->print("writing hdf5");
+
+	lbRegion reg = lattice->region.intersect(series->reg);
+	size_t size = reg.size();
+	hsize_t step = series->times.size();
+	bool first = (step == 0);
+	hsize_t totaldim[5], dim[5], offset[5];
+	totaldim[0] = step + 1;
+	totaldim[1] = series->reg.nz;
+	totaldim[2] = series->reg.ny;
+	totaldim[3] = series->reg.nx;
+	totaldim[4] = 3;
+	dim[0] = 1;
+	dim[1] = reg.nz;
+	dim[2] = reg.ny;
+	dim[3] = reg.nx;
+	dim[4] = 3;
+	offset[0] = step;
+	offset[1] = reg.dz - series->reg.dz;
+	offset[2] = reg.dy - series->reg.dy;
+	offset[3] = reg.dx - series->reg.dx;
+	offset[4] = 0;
+	if (size == 0) for (int i=0; i<5; i++) { dim[i] = 0; offset[i] = 0; }
+
+	flag_t * NodeType = new flag_t[size];
+	lattice->GetFlags(reg, NodeType);
+	unsigned char * flags = new unsigned char[size];
+	int ret = 0;
+	for (const Model::NodeTypeGroupFlag& it : lattice->model->nodetypegroupflags) {
+		hid_t dset_id = hdf5SeriesDataset(series, reg, it.name.c_str(), H5T_NATIVE_UCHAR, 4, false);
+		if (dset_id < 0) { ret = -1; break; }
+		for (size_t i=0;i<size;i++) {
+			flags[i] = (NodeType[i] & it.flag) >> it.shift;
+		}
+		ret = hdf5SeriesWrite(dset_id, 4, totaldim, dim, offset, H5T_NATIVE_UCHAR, flags);
+		if (ret) break;
+		if (first) series->attrs.push_back({ it.name, false, 1, units->alt("1m") });
+	}
+	delete[] flags;
+	delete[] NodeType;
+	if (ret) return ret;
+
+	for (const Model::Quantity& it : lattice->model->quantities) {
+		if (what->in(it.name)) {
+			bool vector = it.isVector;
+#ifdef CALC_DOUBLE_PRECISION
+			hid_t input_type = H5T_NATIVE_DOUBLE;
+#else
+			hid_t input_type = H5T_NATIVE_FLOAT;
+#endif
+			hid_t output_type;
+			int output_precision;
+			if (series->options & HDF5_WRITE_DOUBLE) {
+				output_type = H5T_NATIVE_DOUBLE;
+				output_precision = 8;
+			} else {
+				output_type = H5T_NATIVE_FLOAT;
+				output_precision = 4;
+			}
+			int rank = 4;
+			if (vector) rank = 5;
+			bool lossy = (series->bounds != NULL && !series->bounds->empty());
+			hid_t dset_id = hdf5SeriesDataset(series, reg, it.name.c_str(), output_type, rank, lossy);
+			if (dset_id < 0) return -1;
+			double unit = units->alt(it.unit);
+			int comp = 1;
+			if (vector) comp = 3;
+			real_t* tmp = new real_t[size*comp];
+			lattice->GetQuantity(it.id, reg, tmp, 1/unit);
+			hdf5LossyRound(series->bounds, it.name, tmp, size*comp, output_precision);
+			ret = hdf5SeriesWrite(dset_id, rank, totaldim, dim, offset, input_type, tmp);
+			delete[] tmp;
+			if (ret) return ret;
+			if (first) series->attrs.push_back({ it.name, vector, output_precision, unit });
+		}
+	}
+
+	double time = solver->iter / units->alt("1s");
+	{
+		hsize_t time_dim = 1, time_offset = step;
+		if (lattice->mpi.rank != 0) time_dim = 0;
+		if (lattice->mpi.rank != 0) time_offset = 0;
+		hsize_t time_total = step + 1;
+		ret = hdf5SeriesWrite(series->time_id, 1, &time_total, &time_dim, &time_offset, H5T_NATIVE_DOUBLE, &time);
+		if (ret) return ret;
+	}
+	H5Fflush(series->file_id, H5F_SCOPE_GLOBAL);
+	series->times.push_back(time);
+
+	if (series->options & HDF5_WRITE_XDMF) {
+		if (lattice->mpi.rank == 0) {
+			std::string xmfname = series->filename.substr(0, series->filename.size() - 3) + ".xmf";
+			ret = hdf5SeriesXdmf(series, solver, xmfname.c_str());
+		}
+	}
+	return ret;
+#else
+	return -1;
+#endif
+}
+
+/// Close the datasets and the file of the time series (collective)
+void hdf5CloseTimeSeries(hdf5TimeSeries * series)
+{
+#ifdef WITH_HDF5
+	if (series == NULL) return;
+	for (std::map< std::string, hid_t >::iterator it = series->dsets.begin(); it != series->dsets.end(); it++) H5Dclose(it->second);
+	H5Dclose(series->time_id);
+	H5Fclose(series->file_id);
+	delete series;
+#endif
+}
@@ -4,14 +4,21 @@
 //	#include "LatticeContainer.h"
 	#include "Solver.h"
 	#include "unit.h"
+	#include "LossyCodec.h"
 
 	#define HDF5_DEFLATE 0x01
 	#define HDF5_WRITE_XDMF 0x02
 	#define HDF5_WRITE_DOUBLE 0x04
 	#define HDF5_WRITE_LBM 0x08
 	#define HDF5_WRITE_POINT 0x10
+	#define HDF5_TIME_SERIES 0x20
 	
-	int hdf5WriteLattice(const char * filename, Solver * solver, name_set * s, unsigned long int* chunkdim_, unsigned int options, lbRegion region);
+	int hdf5WriteLattice(const char * filename, Solver * solver, name_set * s, unsigned long int* chunkdim_, unsigned int options, lbRegion region, const ErrorBounds * bounds = NULL);
+
+	struct hdf5TimeSeries;
+	hdf5TimeSeries * hdf5OpenTimeSeries(const char * filename, Solver * solver, unsigned long int* chunkdim_, unsigned int options, lbRegion region, const ErrorBounds * bounds = NULL);
+	int hdf5WriteTimeSeries(hdf5TimeSeries * series, Solver * solver, name_set * s);
+	void hdf5CloseTimeSeries(hdf5TimeSeries * series);
 
 #endif
 #define HDF5LATTICE_H 1
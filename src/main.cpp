@@ -180,7 +180,15 @@ int main ( int argc, char * argv[] )
 
 	// Error handling for scanf
 	#define HANDLE_IOERR(x) if ((x) == EOF) { error("Error in fscanf.\n"); return -1; }
+#ifdef CROSS_OPENMP
+	// The master thread progresses MPI inside OpenMP regions
+	int provided;
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+	// Without it, the exchange is only waited for after the interior kernel
+	if (provided < MPI_THREAD_FUNNELED) CpuProgressAllowed = false;
+#else
 	MPI_Init(&argc, &argv);
+#endif
 	MPMD.Init(MPI_COMM_WORLD,"TCLB");
 	MPMD.Identify();
 
@@ -191,6 +199,9 @@ int main ( int argc, char * argv[] )
 	DEBUG_SETRANK(solver->mpi_rank);
 	DEBUG_M;
 	InitPrint(DEBUG_LEVEL, 6, 8);
+#ifdef CROSS_OPENMP
+	if (!CpuProgressAllowed) WARNING("MPI does not support MPI_THREAD_FUNNELED, the halo exchange will not overlap the computation\n");
+#endif
 	MPI_Barrier(MPMD.local);
 
 	start_walltime();
@@ -220,6 +231,8 @@ int main ( int argc, char * argv[] )
 	solver->mpi.size = solver->mpi_size;
 	solver->mpi.rank = solver->mpi_rank;
 	solver->mpi.gpu = 0;
+	solver->mpi.shm = 0;
+	solver->mpi.halo_precision = HALO_FULL;
 	for (int i=0;i < solver->mpi_size; i++) solver->mpi.node[i].rank = i;
 
 	// Reading arguments
@@ -393,10 +406,240 @@ int main ( int argc, char * argv[] )
 		NOTICE("Will be running nonstationary adjoint at %d Snaps\n", D_MPI_RANK, ns);
 	}
 
+	// Placement of the CPU memory (before anything is allocated)
+	#ifdef CROSS_CPU
+	{
+		pugi::xml_attribute attr = config.attribute("cpu_first_touch");
+		if (attr) CpuMemory.first_touch = attr.as_bool();
+		attr = config.attribute("cpu_huge_pages");
+		if (attr) {
+			std::string val = attr.value();
+			if (val == "no") {
+				CpuMemory.huge_pages = CPU_HUGE_NO;
+			} else if (val == "transparent") {
+				CpuMemory.huge_pages = CPU_HUGE_TRANSPARENT;
+			} else if (val == "explicit") {
+				CpuMemory.huge_pages = CPU_HUGE_EXPLICIT;
+			} else {
+				ERROR("Wrong cpu_huge_pages: %s (should be no, transparent or explicit)\n", val.c_str());
+				return -1;
+			}
+		}
+		attr = config.attribute("cpu_team");
+		if (attr) {
+			std::string val = attr.value();
+			if (val == "no") {
+				CpuTeamConf.enabled = false;
+			} else if (val == "yes") {
+				CpuTeamConf.enabled = true;
+				CpuTeamConf.pin = false;
+			} else if (val == "pinned") {
+				CpuTeamConf.enabled = true;
+				CpuTeamConf.pin = true;
+			} else {
+				ERROR("Wrong cpu_team: %s (should be no, yes or pinned)\n", val.c_str());
+				return -1;
+			}
+		#ifndef CROSS_OPENMP
+			if (CpuTeamConf.enabled) WARNING("cpu_team needs OpenMP (--with-openmp). Ignoring\n");
+		#endif
+		}
+	}
+	#endif
+
+	// Domain decomposition (equal boxes, or balanced by the cost of the nodes)
+	{
+		pugi::xml_attribute attr = config.attribute("decomposition");
+		if (attr) {
+			std::string val = attr.value();
+			if (val == "box") {
+				solver->decomposition = DECOMPOSITION_BOX;
+			} else if (val == "weighted") {
+				solver->decomposition = DECOMPOSITION_WEIGHTED;
+			} else {
+				ERROR("Wrong decomposition: %s (should be box or weighted)\n", val.c_str());
+				return -1;
+			}
+		}
+		attr = config.attribute("sparse");
+		if (attr) solver->decomposition_solid = attr.value();
+		attr = config.attribute("decomposition_solid");
+		if (attr) solver->decomposition_solid = attr.value();
+		// With sparse execution the solid nodes are (mostly) skipped, without it they are only cheaper (no collision).
+		// 0.25 is a tunable guess, not a measured cost (it depends on the model and the hardware): it can be set with
+		// decomposition_solid_cost, or replaced by the load measured with Rebalance (decomposition_load).
+		solver->decomposition_solid_cost = config.attribute("sparse") ? 0.0 : 0.25;
+		attr = config.attribute("decomposition_solid_cost");
+		if (attr) solver->decomposition_solid_cost = attr.as_double();
+		attr = config.attribute("decomposition_coarsen");
+		if (attr) solver->decomposition_coarsen = attr.as_int();
+		attr = config.attribute("decomposition_load");
+		if (attr) {
+			solver->decomposition_load = attr.value();
+			if (solver->decomposition != DECOMPOSITION_WEIGHTED) {
+				if (config.attribute("decomposition")) {
+					WARNING("decomposition_load is used only by the weighted decomposition\n");
+				} else {
+					solver->decomposition = DECOMPOSITION_WEIGHTED;
+				}
+			}
+		}
+	}
+
+	// Placement of the parts of the lattice on the processors
+	{
+		pugi::xml_attribute attr = config.attribute("mpi_placement");
+		if (attr) {
+			std::string val = attr.value();
+			if (val == "none") {
+				solver->placement = PLACEMENT_NONE;
+			} else if (val == "graph") {
+				solver->placement = PLACEMENT_GRAPH;
+			} else if (val == "node") {
+				solver->placement = PLACEMENT_NODE;
+			} else {
+				ERROR("Wrong mpi_placement: %s (should be none, graph or node)\n", val.c_str());
+				return -1;
+			}
+		}
+	}
+
+	// Halo exchange through shared memory with the processes on the same node
+	{
+		pugi::xml_attribute attr = config.attribute("mpi_shared_memory");
+		if (attr && attr.as_bool()) {
+		#if !defined(MPI_ZERO_COPY)
+			WARNING("mpi_shared_memory is supported only on CPU. Ignoring\n");
+		#elif defined(ADJOINT)
+			WARNING("mpi_shared_memory is not supported in adjoint models. Ignoring\n");
+		#else
+			solver->mpi.shm = 1;
+		#endif
+		}
+	}
+
+	// Reduced precision of the halo sent with MPI
+	{
+		pugi::xml_attribute attr = config.attribute("mpi_halo_precision");
+		if (attr) {
+			std::string val = attr.value();
+			int prec;
+			if (val == "full") {
+				prec = HALO_FULL;
+			} else if (val == "float") {
+				prec = HALO_FLOAT;
+			} else if (val == "half") {
+				prec = HALO_HALF;
+			} else if (val == "bfloat16") {
+				prec = HALO_BFLOAT16;
+			} else {
+				ERROR("Wrong mpi_halo_precision: %s (should be full, float, half or bfloat16)\n", val.c_str());
+				return -1;
+			}
+		#if defined(STORAGE_BITS) || defined(CROSS_MPI_OLD)
+			if (prec != HALO_FULL) WARNING("mpi_halo_precision is not supported with this storage. Ignoring\n");
+		#elif defined(ADJOINT)
+			if (prec != HALO_FULL) WARNING("mpi_halo_precision is not supported in adjoint models. Ignoring\n");
+		#else
+			#ifndef CALC_DOUBLE_PRECISION
+			if (prec == HALO_FLOAT) prec = HALO_FULL; // Already single precision
+			#endif
+			solver->mpi.halo_precision = prec;
+		#endif
+		}
+	}
+
+	// Output files written in the background
+	{
+		pugi::xml_attribute attr = config.attribute("output_async");
+		if (attr) {
+			int n = attr.as_int();
+			if (n < 0) {
+				ERROR("Wrong output_async: %s (should be the number of the writes in flight)\n", attr.value());
+				return -1;
+			}
+			solver->outqueue.Start(n);
+			if (n > 0) output("Asynchronous output: up to %d writes in flight\n", n);
+		}
+	}
+
 	// Initializing the lattice of a specific size
 	if (solver->setSize(nx,ny,nz,ns)) return -1;
 	solver->setOutput("");
 
+	// Tiling and wavefront of the CPU kernels
+	#ifdef CROSS_CPU
+	{
+		pugi::xml_attribute attr = config.attribute("cpu_tile");
+		if (attr) {
+			std::string val = attr.value();
+			if (val == "auto") {
+				size_t row_size = (size_t) solver->lattice->region.nx * (2 * solver->lattice->model->fields.size() * sizeof(storage_t) + sizeof(flag_t));
+				CpuTile.x = CpuTile.y = CpuTileAuto(row_size);
+			} else {
+				int ret = sscanf(val.c_str(), "%ux%u", &CpuTile.x, &CpuTile.y);
+				if (ret == 1) CpuTile.y = CpuTile.x;
+				if (ret < 1) {
+					ERROR("Wrong cpu_tile: %s (should be auto, N or NxM)\n", val.c_str());
+					return -1;
+				}
+			}
+		}
+		attr = config.attribute("cpu_tile_order");
+		if (attr) {
+			std::string val = attr.value();
+			if (val == "morton") {
+				CpuTile.morton = true;
+			} else if (val == "linear") {
+				CpuTile.morton = false;
+			} else {
+				ERROR("Wrong cpu_tile_order: %s (should be linear or morton)\n", val.c_str());
+				return -1;
+			}
+		}
+		if (CpuTile.x > 0 && CpuTile.y > 0) output("CPU tiles: %ux%u (%s order)\n", CpuTile.x, CpuTile.y, CpuTile.morton ? "morton" : "linear");
+		attr = config.attribute("cpu_wavefront");
+		if (attr) {
+			int steps = attr.as_int();
+			if (steps < 1) {
+				ERROR("Wrong cpu_wavefront: %s (should be a positive number of iterations)\n", attr.value());
+				return -1;
+			}
+			solver->lattice->wavefront_steps = steps;
+			output("Wavefront: up to %d iterations in one sweep\n", steps);
+			if (solver->mpi_size > 1) WARNING("Wavefront is not used in decomposed runs (it would need a halo as deep as the number of iterations)\n");
+		}
+		attr = config.attribute("cpu_wavefront_tile");
+		if (attr) {
+			int rows = attr.as_int();
+			if (rows < 1) {
+				ERROR("Wrong cpu_wavefront_tile: %s (should be a positive number of rows)\n", attr.value());
+				return -1;
+			}
+			solver->lattice->wavefront_tile = rows;
+		}
+	}
+	#endif
+
+	// Sparse execution (skipping nodes deep inside one node type)
+	{
+		pugi::xml_attribute attr = config.attribute("sparse");
+		if (attr) {
+			std::string val = attr.value();
+#if AA_PATTERN
+			ERROR("Sparse execution is not possible with the in-place (AA) streaming: the skipped nodes would not swap their populations\n");
+			return -1;
+#endif
+			const Model::NodeTypeFlag& nt = solver->lattice->model->nodetypeflags.by_name(val);
+			if (!nt) {
+				ERROR("Wrong sparse: \"%s\" is not a valid node type\n", val.c_str());
+				return -1;
+			}
+			solver->lattice->SparseSet(nt.flag, nt.group_flag);
+			output("Sparse execution: skipping nodes surrounded by %s\n", val.c_str());
+		}
+	}
+
 	//Setting settings to default
 	// Initializing the CUDA events and setting callback
 	CudaEventCreate( &start );
@@ -412,6 +655,9 @@ int main ( int argc, char * argv[] )
 			return -1;
 		}
 	}
+	if (solver->outqueue.Wait()) {
+		ERROR("Writing of the output failed\n");
+	}
     #ifdef EMBEDED_PYTHON
     Py_Finalize();
     #endif
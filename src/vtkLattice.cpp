@@ -6,37 +6,52 @@
 //#include <unistd.h>
 #include "Global.h"
 
-int vtkWriteLattice(char * filename, Lattice * lattice, UnitEnv units, name_set * what, lbRegion total_output_reg)
+/// Write the lattice to a VTI file
+/**
+	The flags and quantities are gathered here (into the buffers of the queue),
+	and encoded and written by the queue (in the background, if asynchronous)
+	\param encoding Encoding of the arrays (VTK_*)
+	\param shared Write one file with all the processes (MPI-IO, synchronous)
+	\param aggregators Number of the processes writing the shared file (0 - chosen by MPI)
+*/
+int vtkWriteLattice(char * filename, Lattice * lattice, UnitEnv units, name_set * what, lbRegion total_output_reg, int encoding, bool shared, int aggregators, OutputQueue * queue)
 {
 	size_t size;
 	lbRegion local_reg = lattice->region;
 	lbRegion reg = local_reg.intersect(total_output_reg);
 	size = reg.size();
-	myprint(1,-1,"Writing region %dx%dx%d + %d,%d,%d (size %d) from %dx%dx%d + %d,%d,%d",
+	myprint(1,-1,"Writing region %dx%dx%d + %d,%d,%d (size %ld) from %dx%dx%d + %d,%d,%d",
 		reg.nx,reg.ny,reg.nz,reg.dx,reg.dy,reg.dz, size,
 		local_reg.nx,local_reg.ny,local_reg.nz,local_reg.dx,local_reg.dy,local_reg.dz);
 
-	vtkFileOut vtkFile(MPMD.local);
-	if (vtkFile.Open(filename)) {return -1;}
+	std::shared_ptr<vtkFileOut> vtkFile = std::make_shared<vtkFileOut>(MPMD.local);
+	vtkFile->SetEncoding(encoding);
+	if (shared) {
+		if (vtkFile->OpenShared(filename, aggregators)) {return -1;}
+	} else {
+		if (vtkFile->Open(filename)) {return -1;}
+	}
 	double spacing = 1/units.alt("m");
-	vtkFile.Init(total_output_reg, reg, "Scalars=\"rho\" Vectors=\"velocity\"", spacing, lattice->px*spacing, lattice->py*spacing, lattice->pz*spacing);
+	vtkFile->Init(total_output_reg, reg, "Scalars=\"rho\" Vectors=\"velocity\"", spacing, lattice->px*spacing, lattice->py*spacing, lattice->pz*spacing);
 
-	{	flag_t * NodeType = new flag_t[size];
+	std::vector< std::function<void()> > fields; // Writing of the gathered fields
+	{	OutputBuffer flags = queue->Buffer(size*sizeof(flag_t));
+		flag_t * NodeType = (flag_t *) flags->data();
 		lattice->GetFlags(reg, NodeType);
 		if (what->explicitlyIn("flag")) {
-			vtkFile.WriteField("flag",NodeType);
+			fields.push_back([vtkFile, flags]() { vtkFile->WriteField("flag", (flag_t *) flags->data()); });
 		}
-		unsigned char * small = new unsigned char[size];
 		for (const Model::NodeTypeGroupFlag& it : lattice->model->nodetypegroupflags) {
 			if ((what->all && it.isSave) || what->explicitlyIn(it.name)) {
+				OutputBuffer buf = queue->Buffer(size);
+				unsigned char * small = (unsigned char *) buf->data();
 				for (size_t i=0;i<size;i++) {
 					small[i] = (NodeType[i] & it.flag) >> it.shift;
 				}
-				vtkFile.WriteField(it.name.c_str(),small);
+				std::string name = it.name;
+				fields.push_back([vtkFile, buf, name]() { vtkFile->WriteField(name.c_str(), (unsigned char *) buf->data()); });
 			}
 		}
-		delete[] small;
-		delete[] NodeType;
 	}
 
 	for (const Model::Quantity& it : lattice->model->quantities) {
@@ -44,40 +59,67 @@ int vtkWriteLattice(char * filename, Lattice * lattice, UnitEnv units, name_set
 			double v = units.alt(it.unit);
 			int comp = 1;
 			if (it.isVector) comp = 3;
-	                real_t* tmp = new real_t[size*comp];
-                        lattice->GetQuantity(it.id, reg, tmp, 1/v);
-			vtkFile.WriteField(it.name.c_str(), tmp, comp);
-			delete[] tmp;
+			OutputBuffer buf = queue->Buffer(size*comp*sizeof(real_t));
+			lattice->GetQuantity(it.id, reg, (real_t *) buf->data(), 1/v);
+			std::string name = it.name;
+			fields.push_back([vtkFile, buf, name, comp]() { vtkFile->WriteField(name.c_str(), (real_t *) buf->data(), comp); });
 		}
 	}
-	vtkFile.Finish();
-	vtkFile.Close();
-	return 0;
+	OutputQueue::Job job = [vtkFile, fields]() {
+		for (size_t i=0;i<fields.size();i++) fields[i]();
+		vtkFile->Finish();
+		vtkFile->Close();
+		return 0;
+	};
+	if (shared) return job(); // The shared file is written collectively
+	return queue->Push(job);
 }
 
-int binWriteLattice(char * filename, Lattice * lattice, UnitEnv units)
+/// Write the quantities of the lattice to binary files (one per quantity)
+/**
+	With error bounds, the quantities are written with LossyEncode to
+	.lbin files (see tools/lbin.py), instead of the raw .bin files
+	\param bounds Error bounds of the quantities (NULL - lossless)
+*/
+int binWriteLattice(char * filename, Lattice * lattice, UnitEnv units, const ErrorBounds * bounds, OutputQueue * queue)
 {
-	int size;
+	size_t size;
 	lbRegion reg = lattice->region;
-	FILE * f;
-	char fn[STRING_LEN];
 	size = reg.size();
+	int ret = 0;
+	bool lossy = (bounds != NULL && !bounds->empty());
 	for (const Model::Quantity& it : lattice->model->quantities) {
 		int comp = 1;
 		if (it.isVector) comp = 3;
-		real_t* tmp = new real_t[size*comp];
-		lattice->GetQuantity(it.id, reg, tmp, 1);
-		sprintf(fn, "%s.%s.bin", filename, it.name.c_str());
-		f = fopen(fn,"w");
-		if (f == NULL) {
-			ERROR("Cannot open file: %s\n",fn);
-			return -1;
+		OutputBuffer buf = queue->Buffer(size*comp*sizeof(real_t));
+		lattice->GetQuantity(it.id, reg, (real_t *) buf->data(), 1);
+		char fn[STRING_LEN];
+		double step = 0, offset = 0;
+		if (lossy) {
+			step = LossyStep(*bounds, it.name, (real_t *) buf->data(), size*comp, MPMD.local, offset);
+			sprintf(fn, "%s.%s.lbin", filename, it.name.c_str());
+		} else {
+			sprintf(fn, "%s.%s.bin", filename, it.name.c_str());
 		}
-		fwrite(tmp, sizeof(real_t)*comp, size, f);
-		fclose(f);
-		delete[] tmp;
+		std::string name = fn;
+		if (queue->Push([buf, name, lossy, comp, step, offset]() {
+			FILE * f = fopen(name.c_str(),"w");
+			if (f == NULL) {
+				ERROR("Cannot open file: %s\n",name.c_str());
+				return -1;
+			}
+			if (lossy) {
+				std::vector<char> enc;
+				LossyEncode((real_t *) buf->data(), buf->size() / sizeof(real_t), comp, step, offset, enc);
+				fwrite(enc.data(), 1, enc.size(), f);
+			} else {
+				fwrite(buf->data(), 1, buf->size(), f);
+			}
+			fclose(f);
+			return 0;
+		})) ret = -1;
 	}
-	return 0;
+	return ret;
 }
 
 
@@ -94,9 +136,9 @@ inline int txtWriteElement(FILE * f, vector_t tmp) {
 	return txtWriteElement(f, tmp.z);
 }
 
-template <typename T> int txtWriteField(FILE * f, T * tmp, int stop, int n)
+template <typename T> int txtWriteField(FILE * f, T * tmp, int stop, size_t n)
 {
-	for (int i=0;i<n;i++) {
+	for (size_t i=0;i<n;i++) {
 		txtWriteElement(f, tmp[i]);
 		if (((i+1) % stop) == 0) fprintf(f,"\n"); else fprintf(f, " ");
 	}
@@ -104,58 +146,67 @@ template <typename T> int txtWriteField(FILE * f, T * tmp, int stop, int n)
 }
 
 
-int txtWriteLattice(char * filename, Lattice * lattice, UnitEnv units, name_set * what, int type)
+int txtWriteLattice(char * filename, Lattice * lattice, UnitEnv units, name_set * what, int type, OutputQueue * queue)
 {
-	int size;
+	size_t size;
 	char fn[STRING_LEN];
 	lbRegion reg = lattice->region;
 	size = reg.size();
+	if (type != 0 && type != 1) {
+		ERROR("Unknown type in txtWriteLattice\n");
+		return -1;
+	}
+	int ret = 0;
 	if (D_MPI_RANK == 0) {
 		sprintf(fn,"%s_info.txt",filename);
-		FILE * f = fopen(fn,"w");
-		if (f == NULL) {
-			ERROR("Cannot open file: %s\n");
-			return -1;
-		}
-		fprintf(f,"dx: %lg\n", 1/units.alt("m"));
-		fprintf(f,"dt: %lg\n", 1/units.alt("s"));
-		fprintf(f,"dm: %lg\n", 1/units.alt("kg"));
-		fprintf(f,"dT: %lg\n", 1/units.alt("K"));
-		fprintf(f,"size: %d\n", size);
-		fprintf(f,"NX: %d\n", reg.nx);
-		fprintf(f,"NY: %d\n", reg.ny);
-		fprintf(f,"NZ: %d\n", reg.nz);
-		fclose(f);
+		std::string name = fn;
+		double dx = 1/units.alt("m"), dt = 1/units.alt("s"), dm = 1/units.alt("kg"), dT = 1/units.alt("K");
+		if (queue->Push([name, dx, dt, dm, dT, size, reg]() {
+			FILE * f = fopen(name.c_str(),"w");
+			if (f == NULL) {
+				ERROR("Cannot open file: %s\n", name.c_str());
+				return -1;
+			}
+			fprintf(f,"dx: %lg\n", dx);
+			fprintf(f,"dt: %lg\n", dt);
+			fprintf(f,"dm: %lg\n", dm);
+			fprintf(f,"dT: %lg\n", dT);
+			fprintf(f,"size: %ld\n", size);
+			fprintf(f,"NX: %d\n", reg.nx);
+			fprintf(f,"NY: %d\n", reg.ny);
+			fprintf(f,"NZ: %d\n", reg.nz);
+			fclose(f);
+			return 0;
+		})) ret = -1;
 	}
 
 	for (const Model::Quantity& it : lattice->model->quantities) {
 		if (what->in(it.name)) {
 			sprintf(fn,"%s_%s.txt", filename, it.name.c_str());
-			FILE * f=NULL;
-			switch (type) {
-			case 0:
-				f = fopen(fn,"w");
-				break;
-			case 1:
-				char com[STRING_LEN];
-				sprintf(com, "gzip > %s.gz", fn);
-				f = popen(com, "w");
-				break;
-			default:
-				ERROR("Unknown type in txtWriteLattice\n");
-			}
-			if (f == NULL) {
-				ERROR("Cannot open file: %s\n",fn);
-				return -1;
-			}
+			std::string name = fn;
 			double v = units.alt(it.unit);
-			real_t* tmp = new real_t[size];
-			lattice->GetQuantity(it.id, reg, tmp, 1/v);
-			txtWriteField(f, tmp, reg.nx, size);
-			delete[] tmp;
-			fclose(f);
+			OutputBuffer buf = queue->Buffer(size*sizeof(real_t));
+			lattice->GetQuantity(it.id, reg, (real_t *) buf->data(), 1/v);
+			if (queue->Push([name, buf, type, reg, size]() {
+				FILE * f=NULL;
+				if (type == 1) {
+					char com[STRING_LEN];
+					sprintf(com, "gzip > %s.gz", name.c_str());
+					f = popen(com, "w");
+				} else {
+					f = fopen(name.c_str(),"w");
+				}
+				if (f == NULL) {
+					ERROR("Cannot open file: %s\n",name.c_str());
+					return -1;
+				}
+				txtWriteField(f, (real_t *) buf->data(), reg.nx, size);
+				if (type == 1) pclose(f); else fclose(f);
+				return 0;
+			})) ret = -1;
 		}
 	}
 
-	return 0;
+	return ret;
 }
+
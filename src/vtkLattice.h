@@ -6,10 +6,12 @@
 	#include "vtkOutput.h"
 	#include "unit.h"
 	#include "utils.h"
+	#include "OutputQueue.h"
+	#include "LossyCodec.h"
 
-	int vtkWriteLattice(char * filename, Lattice * lattice, UnitEnv, name_set * s, lbRegion region);
-	int binWriteLattice(char * filename, Lattice * lattice, UnitEnv units);
-	int txtWriteLattice(char * filename, Lattice * lattice, UnitEnv, name_set * s, int type);
+	int vtkWriteLattice(char * filename, Lattice * lattice, UnitEnv, name_set * s, lbRegion region, int encoding, bool shared, int aggregators, OutputQueue * queue);
+	int binWriteLattice(char * filename, Lattice * lattice, UnitEnv units, const ErrorBounds * bounds, OutputQueue * queue);
+	int txtWriteLattice(char * filename, Lattice * lattice, UnitEnv, name_set * s, int type, OutputQueue * queue);
 	void screenDumpLattice(Lattice * lattice);
 	int initMean(char * filename);
 	int writeMean(char * filename, Lattice * lattice, int, int iter, double);
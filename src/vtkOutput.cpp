@@ -3,13 +3,18 @@
 #include "vtkOutput.h"
 #include <cstring>
 #include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#ifdef WITH_ZLIB
+	#include <zlib.h>
+#endif
 
 const char * base64char = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-void Base64char3(unsigned char * in, int len, char * out)
+void Base64char3(unsigned char * in, size_t len, char * out)
 {
 	if (len > 3) len = 3;
-	int i;
+	size_t i;
 	unsigned int w = 0;
 	for (i = 0; i< len; i++) w = (w << 8) + (int) (in[i]);
 	for (     ; i< 3;   i++) w =  w << 8;
@@ -20,12 +25,13 @@ void Base64char3(unsigned char * in, int len, char * out)
 	for (i = len; i <3; i++) out[i+1] = '=';
 }
 
-void fprintB64(FILE* f, void * tab, int len)
+void fprintB64(FILE* f, void * tab, size_t len)
 {
 	#define B64LineLen 76
 	char buf[B64LineLen + 1];
 	buf[B64LineLen] = 0;
-	int i,k=0;
+	size_t i;
+	int k=0;
 	for (i=0; i<len;) {
 		Base64char3(((unsigned char*)tab) + i, len - i, buf + k);
 		i += 3;
@@ -40,15 +46,34 @@ void fprintB64(FILE* f, void * tab, int len)
 }
 
 // order of % arguments: width height width height
-//const char * vtk_header       = "<?xml version=\"1.0\"?>\n<VTKFile type=\"ImageData\" version=\"0.1\" byte_order=\"LittleEndian\">\n<ImageData WholeExtent=\"0 %d 0 %d 0 %d\" Origin=\"0 0 0\" Spacing=\"0.005 0.005 0.005\">\n<Piece Extent=\"0 %d 0 %d 0 %d\">\n<PointData %s>\n";
+//const char * vtk_header       = "<?xml version=\"1.0\"?>\n<VTKFile type=\"ImageData\" version=\"0.1\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n<ImageData WholeExtent=\"0 %d 0 %d 0 %d\" Origin=\"0 0 0\" Spacing=\"0.005 0.005 0.005\">\n<Piece Extent=\"0 %d 0 %d 0 %d\">\n<PointData %s>\n";
 // order of % arguments: datatype fieldname
 const char * vtk_field_header = "<DataArray type=\"%s\" Name=\"%s\" format=\"binary\" encoding=\"base64\" NumberOfComponents=\"%d\">\n";
 const char * vtk_field_footer = "</DataArray>\n";
 const char * vtk_field_parallel = "<PDataArray type=\"%s\" Name=\"%s\" format=\"binary\" encoding=\"base64\" NumberOfComponents=\"%d\"/>\n";
+// order of % arguments: datatype fieldname components offset
+const char * vtk_field_appended = "<DataArray type=\"%s\" Name=\"%s\" NumberOfComponents=\"%d\" format=\"appended\" offset=\"%llu\"/>\n";
+const char * vtk_field_parallel_appended = "<PDataArray type=\"%s\" Name=\"%s\" NumberOfComponents=\"%d\"/>\n";
 const char * vtk_footer       = "</CellData>\n</Piece>\n</ImageData>\n</VTKFile>\n";
+const char * vtk_footer_appended = "</CellData>\n</Piece>\n</ImageData>\n<AppendedData encoding=\"raw\">\n_";
+const char * vtk_footer_appended_end = "\n</AppendedData>\n</VTKFile>\n";
+
+#define VTK_ZLIB_BLOCK 32768 ///< Size of the blocks compressed with zlib (as in vtkZLibDataCompressor)
+
+/// Get the encoding (VTK_*) by name
+/**
+ \param name base64, appended or zlib
+ \return the encoding, or -1 if the name is wrong
+*/
+int vtkEncoding(const std::string& name) {
+	if (name == "base64") return VTK_BASE64;
+	if (name == "appended") return VTK_APPENDED;
+	if (name == "zlib") return VTK_ZLIB;
+	return -1;
+}
 
 // Error handler
-#define FERR 	if (f == NULL) {fprintf(stderr, "Error: vtkOutput tried to write before opening a file\n"); return; } 
+#define FERR 	if (f == NULL && !shared) {fprintf(stderr, "Error: vtkOutput tried to write before opening a file\n"); return; } 
 	
 // Class for writing vtk file
 vtkFileOut::vtkFileOut (MPI_Comm comm_)
@@ -57,6 +82,22 @@ vtkFileOut::vtkFileOut (MPI_Comm comm_)
 	fp = NULL;
 	size = 0;
 	comm = comm_;
+	encoding = VTK_BASE64;
+	shared = false;
+};
+
+/// Set the encoding of the arrays (VTK_*)
+/**
+ Has to be called before Init. Without zlib, VTK_ZLIB falls back to VTK_APPENDED.
+*/
+void vtkFileOut::SetEncoding(int encoding_) {
+	encoding = encoding_;
+#ifndef WITH_ZLIB
+	if (encoding == VTK_ZLIB) {
+		fprintf(stderr, "Warning: vtkOutput compiled without zlib. Writing uncompressed\n");
+		encoding = VTK_APPENDED;
+	}
+#endif
 };
 
 int vtkFileOut::Open(const char* filename) {
@@ -91,7 +132,38 @@ int vtkFileOut::Open(const char* filename) {
 	return 0;
 };
 
-void vtkFileOut::WriteB64(void * tab, int len) {
+/// Open one file written by all the processes
+/**
+ The file has one Piece over the whole region, with the arrays raw in the
+ AppendedData section. Each process writes its part of every array
+ collectively with MPI-IO, through a subarray view of the file, in Finish.
+ \param filename Name of the (collective) vti file
+ \param aggregators Number of the processes writing to the file system (0 - chosen by MPI)
+*/
+int vtkFileOut::OpenShared(const char* filename, int aggregators) {
+	MPI_Info info;
+	MPI_Info_create(&info);
+	if (aggregators > 0) {
+		char buf[32];
+		sprintf(buf, "%d", aggregators);
+		MPI_Info_set(info, "cb_nodes", buf);
+		MPI_Info_set(info, "romio_cb_write", "enable");
+	}
+	int ret = MPI_File_open(comm, filename, MPI_MODE_WRONLY | MPI_MODE_CREATE, info, &fh);
+	MPI_Info_free(&info);
+	if (ret != MPI_SUCCESS) {fprintf(stderr, "Error: Could not open vtk file %s\n", filename); return -1; }
+	MPI_File_set_size(fh, 0);
+	shared = true;
+	if (encoding != VTK_APPENDED) {
+		int rank;
+		MPI_Comm_rank(comm, &rank);
+		if (encoding == VTK_ZLIB && rank == 0) fprintf(stderr, "Warning: vtkOutput cannot compress a shared file. Writing uncompressed\n");
+		encoding = VTK_APPENDED;
+	}
+	return 0;
+};
+
+void vtkFileOut::WriteB64(void * tab, size_t len) {
 	FERR;
 	fprintB64(f, tab, len);
 };
@@ -99,7 +171,30 @@ void vtkFileOut::WriteB64(void * tab, int len) {
 void vtkFileOut::Init(lbRegion regiontot, lbRegion region, char* selection, double spacing, double px, double py, double pz) {
 	FERR;
 	size = region.size();
-	fprintf(f, "<?xml version=\"1.0\"?>\n<VTKFile type=\"ImageData\" version=\"0.1\" byte_order=\"LittleEndian\">\n");
+	appended.clear();
+	if (shared) {
+		char buf[STRING_LEN];
+		totalregion = regiontot;
+		localregion = region;
+		arrays.clear();
+		sprintf(buf, "<ImageData WholeExtent=\"%d %d %d %d %d %d\" Origin=\"%lg %lg %lg\" Spacing=\"%lg %lg %lg\">\n<Piece Extent=\"%d %d %d %d %d %d\">\n<CellData %s>\n",
+			regiontot.dx, regiontot.dx + regiontot.nx,
+			regiontot.dy, regiontot.dy + regiontot.ny,
+			regiontot.dz, regiontot.dz + regiontot.nz,
+			px, py, pz,
+			spacing,
+			spacing,
+			spacing,
+			regiontot.dx, regiontot.dx + regiontot.nx,
+			regiontot.dy, regiontot.dy + regiontot.ny,
+			regiontot.dz, regiontot.dz + regiontot.nz,
+			selection
+		);
+		header = buf;
+		return;
+	}
+	fprintf(f, "<?xml version=\"1.0\"?>\n<VTKFile type=\"ImageData\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\"%s>\n",
+		encoding == VTK_ZLIB ? " compressor=\"vtkZLibDataCompressor\"" : "");
 	fprintf(f, "<ImageData WholeExtent=\"%d %d %d %d %d %d\" Origin=\"%lg %lg %lg\" Spacing=\"%lg %lg %lg\">\n",
 		region.dx, region.dx + region.nx,
 		region.dy, region.dy + region.ny,
@@ -116,7 +211,7 @@ void vtkFileOut::Init(lbRegion regiontot, lbRegion region, char* selection, doub
 	);
 	fprintf(f, "<CellData %s>\n", selection);
 	if (fp != NULL) {
-		fprintf(fp, "<?xml version=\"1.0\"?>\n<VTKFile type=\"PImageData\" version=\"0.1\" byte_order=\"LittleEndian\">\n");
+		fprintf(fp, "<?xml version=\"1.0\"?>\n<VTKFile type=\"PImageData\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n");
 		fprintf(fp, "<PImageData WholeExtent=\"%d %d %d %d %d %d\" Origin=\"%lg %lg %lg\" Spacing=\"%lg %lg %lg\">\n",
 			regiontot.dx, regiontot.dx + regiontot.nx,
 			regiontot.dy, regiontot.dy + regiontot.ny,
@@ -156,11 +251,67 @@ void vtkFileOut::Init(int width, int height) {
 	Init(lbRegion(0,0,0,width,height,1),"");
 };
 
+/// Append an array to the AppendedData section
+/**
+ Uncompressed: the size (UInt64) and the data.
+ With zlib (layout of vtkZLibDataCompressor): the number of blocks,
+ the size of a block, the size of the last block, the compressed sizes of
+ the blocks (all UInt64) and the compressed blocks.
+*/
+void vtkFileOut::AppendBlocks(void * data, size_t len) {
+	const char * src = (const char *) data;
+	if (encoding != VTK_ZLIB) {
+		uint64_t head = len;
+		appended.insert(appended.end(), (const char *) &head, (const char *) &head + sizeof(head));
+		appended.insert(appended.end(), src, src + len);
+		return;
+	}
+#ifdef WITH_ZLIB
+	uint64_t nblocks = (len + VTK_ZLIB_BLOCK - 1) / VTK_ZLIB_BLOCK;
+	uint64_t last = len - (nblocks > 0 ? (nblocks - 1) * VTK_ZLIB_BLOCK : 0);
+	size_t head = appended.size();
+	std::vector<uint64_t> header(3 + nblocks);
+	header[0] = nblocks;
+	header[1] = VTK_ZLIB_BLOCK;
+	header[2] = (nblocks > 0 && last < VTK_ZLIB_BLOCK) ? last : 0; // 0 - the last block is full
+	appended.resize(head + header.size() * sizeof(uint64_t));
+	for (uint64_t i = 0; i < nblocks; i++) {
+		uLong in = (i + 1 < nblocks) ? VTK_ZLIB_BLOCK : last;
+		uLongf out = compressBound(in);
+		size_t pos = appended.size();
+		appended.resize(pos + out);
+		compress2((Bytef *) &appended[pos], &out, (const Bytef *) src + i * VTK_ZLIB_BLOCK, in, Z_BEST_SPEED);
+		appended.resize(pos + out);
+		header[3 + i] = out;
+	}
+	memcpy(&appended[head], &header[0], header.size() * sizeof(uint64_t));
+#endif
+};
+
 void vtkFileOut::WriteField(const char * name, void * data, int elem, const char * tp, int components) {
 	FERR;
-	int len = size*elem;
+	uint64_t len = size*elem;
+	if (shared) {
+		Array a;
+		a.type = tp;
+		a.name = name;
+		a.components = components;
+		a.elem = elem;
+		a.offset = appended.size();
+		arrays.push_back(a);
+		appended.insert(appended.end(), (const char *) data, (const char *) data + len);
+		return;
+	}
+	if (encoding != VTK_BASE64) {
+		fprintf(f, vtk_field_appended, tp, name, components, (unsigned long long) appended.size());
+		AppendBlocks(data, len);
+		if (fp != NULL) {
+			fprintf(fp, vtk_field_parallel_appended, tp, name, components);
+		}
+		return;
+	}
 	fprintf(f, vtk_field_header, tp, name, components);
-	WriteB64(&len, sizeof(int));
+	WriteB64(&len, sizeof(uint64_t));
 	WriteB64(data, size*elem);
 	fprintf(f, "\n");
 	fprintf(f, "%s", vtk_field_footer);
@@ -169,9 +320,83 @@ void vtkFileOut::WriteField(const char * name, void * data, int elem, const char
 	}
 };
 
+/// Write the shared file
+/**
+ The header depends only on the whole region and the list of the arrays,
+ so every process knows the offsets of the arrays without communication.
+ Process 0 writes the header, the sizes of the arrays and the footer.
+*/
+void vtkFileOut::FinishShared() {
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+	size_t total = totalregion.size();
+	std::string xml = "<?xml version=\"1.0\"?>\n<VTKFile type=\"ImageData\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n";
+	xml += header;
+	std::vector<uint64_t> offset(arrays.size() + 1);
+	offset[0] = 0;
+	for (size_t i = 0; i < arrays.size(); i++) {
+		char buf[STRING_LEN];
+		sprintf(buf, vtk_field_appended, arrays[i].type.c_str(), arrays[i].name.c_str(), arrays[i].components, (unsigned long long) offset[i]);
+		xml += buf;
+		offset[i+1] = offset[i] + sizeof(uint64_t) + total * arrays[i].elem;
+	}
+	xml += vtk_footer_appended;
+	MPI_Offset base = xml.size();
+	if (rank == 0) {
+		MPI_File_write_at(fh, 0, (void *) xml.c_str(), xml.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+		for (size_t i = 0; i < arrays.size(); i++) {
+			uint64_t len = total * arrays[i].elem;
+			MPI_File_write_at(fh, base + offset[i], &len, sizeof(len), MPI_BYTE, MPI_STATUS_IGNORE);
+		}
+		MPI_File_write_at(fh, base + offset[arrays.size()], (void *) vtk_footer_appended_end, strlen(vtk_footer_appended_end), MPI_CHAR, MPI_STATUS_IGNORE);
+	}
+	const lbRegion& reg = localregion;
+	// The counts of MPI are int, so the local part is written in pieces of at most VTK_SHARED_CHUNK nodes
+	unsigned long long pieces = (size + VTK_SHARED_CHUNK - 1) / VTK_SHARED_CHUNK, maxpieces;
+	MPI_Allreduce(&pieces, &maxpieces, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm);
+	for (size_t i = 0; i < arrays.size(); i++) {
+		MPI_Datatype elem, view;
+		MPI_Type_contiguous(arrays[i].elem, MPI_BYTE, &elem);
+		MPI_Type_commit(&elem);
+		MPI_Offset disp = base + offset[i] + sizeof(uint64_t);
+		if (size > 0) {
+			int sizes[3] = { totalregion.nz, totalregion.ny, totalregion.nx };
+			int subsizes[3] = { reg.nz, reg.ny, reg.nx };
+			int starts[3] = { reg.dz - totalregion.dz, reg.dy - totalregion.dy, reg.dx - totalregion.dx };
+			MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, elem, &view);
+			MPI_Type_commit(&view);
+			MPI_File_set_view(fh, disp, elem, view, "native", MPI_INFO_NULL);
+			MPI_Type_free(&view);
+		} else {
+			MPI_File_set_view(fh, disp, elem, elem, "native", MPI_INFO_NULL);
+		}
+		for (unsigned long long k = 0; k < maxpieces; k++) {
+			size_t start = k * VTK_SHARED_CHUNK;
+			size_t count = 0;
+			if (start < size) count = std::min(size - start, (size_t) VTK_SHARED_CHUNK);
+			void * data = NULL;
+			if (count > 0) data = &appended[arrays[i].offset + start * arrays[i].elem];
+			MPI_File_write_all(fh, data, (int) count, elem, MPI_STATUS_IGNORE);
+		}
+		MPI_Type_free(&elem);
+	}
+	std::vector<char>().swap(appended);
+};
+
 void vtkFileOut::Finish() {
 	FERR;
-	fprintf(f, "%s", vtk_footer);
+	if (shared) {
+		FinishShared();
+		return;
+	}
+	if (encoding != VTK_BASE64) {
+		fprintf(f, "%s", vtk_footer_appended);
+		if (appended.size() > 0) fwrite(&appended[0], 1, appended.size(), f);
+		fprintf(f, "%s", vtk_footer_appended_end);
+		std::vector<char>().swap(appended);
+	} else {
+		fprintf(f, "%s", vtk_footer);
+	}
 	if (fp != NULL) {
 		fprintf(fp, "</PCellData>\n</PImageData>\n</VTKFile>\n");
 	}
@@ -179,6 +404,12 @@ void vtkFileOut::Finish() {
 
 void vtkFileOut::Close() {
 	FERR;
+	if (shared) {
+		MPI_File_close(&fh);
+		shared = false;
+		size = 0;
+		return;
+	}
 	fclose(f);
 	if (fp != NULL) fclose(fp);
 	f = NULL; size=0;
@@ -3,19 +3,43 @@
 #include "cross.h"
 #include "types.h"
 #include "Region.h"
-void fprintB64(FILE* f, void * tab, int len);
+#include <vector>
+#include <string>
+void fprintB64(FILE* f, void * tab, size_t len);
+
+#define VTK_BASE64   0 ///< Arrays inline in base64
+#define VTK_APPENDED 1 ///< Arrays raw in the AppendedData section
+#define VTK_ZLIB     2 ///< Arrays raw in the AppendedData section, compressed with zlib in blocks
+
+#ifndef VTK_SHARED_CHUNK
+	#define VTK_SHARED_CHUNK (1 << 28) ///< Max number of nodes in one collective write of a shared file
+#endif
+
+int vtkEncoding(const std::string& name);
 
 class vtkFileOut {
 	FILE * f;
 	FILE * fp;
 	char * name; int name_size;
 	int parallel;
-	int size;
+	size_t size;
 	MPI_Comm comm;
+	int encoding; ///< Encoding of the arrays (VTK_*)
+	std::vector<char> appended; ///< Data of the AppendedData section
+	void AppendBlocks(void * data, size_t len);
+	bool shared; ///< One file written by all the processes with MPI-IO
+	MPI_File fh; ///< The shared file
+	lbRegion totalregion, localregion; ///< Regions of the shared file and of this process
+	std::string header; ///< Attributes of the ImageData in the shared file
+	struct Array { std::string type, name; int components; size_t elem, offset; };
+	std::vector<Array> arrays; ///< Arrays of the shared file (offset in appended)
+	void FinishShared();
 public:
 	vtkFileOut (MPI_Comm comm_=MPI_COMM_WORLD);
+	void SetEncoding(int encoding_);
 	int Open(const char* filename);
-	void WriteB64(void * tab, int len);
+	int OpenShared(const char* filename, int aggregators);
+	void WriteB64(void * tab, size_t len);
 	void Init(lbRegion, lbRegion region, char* selection, double spacing, double, double, double);
 	inline void Init(lbRegion region, char* selection) { Init(region, region, selection); }
 	inline void Init(lbRegion tot, lbRegion region, char* selection) { Init(tot, region, selection, 0.05); }
@@ -0,0 +1,50 @@
+import sys
+import struct
+import numpy as np
+
+# Reader of the lossy compressed .lbin files written by the BIN callback
+# (with abs_error or rel_error). See LossyEncode in src/LossyCodec.cpp
+
+MAGIC = b"TCLBLSY1"
+BLOCK = 64
+
+def read_lbin(filename):
+    with open(filename, "rb") as f:
+        data = f.read()
+    if data[:8] != MAGIC:
+        raise ValueError("%s is not a lossy TCLB binary file" % filename)
+    real_size, comp, n, offset, step = struct.unpack_from("<IIQdd", data, 8)
+    dtype = np.float64 if real_size == 8 else np.float32
+    pos = 8 + struct.calcsize("<IIQdd")
+    if step == 0:
+        ret = np.frombuffer(data, dtype=dtype, count=n, offset=pos).copy()
+    else:
+        zz = np.zeros(n, dtype=np.uint64)
+        raw = np.frombuffer(data, dtype=np.uint8)
+        for i in range(0, n, BLOCK):
+            m = min(BLOCK, n - i)
+            width = int(raw[pos])
+            pos += 1
+            nbytes = (m * width + 7) // 8
+            if width > 0:
+                bits = np.unpackbits(raw[pos:pos+nbytes], bitorder="little")[:m*width]
+                bits = bits.reshape(m, width).astype(np.uint64)
+                zz[i:i+m] = (bits << np.arange(width, dtype=np.uint64)).sum(axis=1, dtype=np.uint64)
+            pos += nbytes
+        delta = (zz >> np.uint64(1)).astype(np.int64) ^ -(zz & np.uint64(1)).astype(np.int64)
+        q = np.cumsum(delta.reshape(-1, comp), axis=0).reshape(-1)
+        ret = (offset + q * step).astype(dtype)
+    if comp > 1:
+        ret = ret.reshape(-1, comp)
+    return ret
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print("Usage: python lbin.py file.lbin [file.bin]")
+        print("  decodes a lossy binary file (to a plain binary file)")
+        sys.exit(1)
+    tab = read_lbin(sys.argv[1])
+    if len(sys.argv) > 2:
+        tab.tofile(sys.argv[2])
+    else:
+        print("%s: %s values of %s, min %g, max %g" % (sys.argv[1], tab.shape, tab.dtype, tab.min(), tab.max()))